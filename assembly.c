@@ -0,0 +1,174 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : assembly.c
+//
+// Second pipeline stage: sub-factories of every order push manufactured
+// batches into one bounded queue, and a pool of assembly/QA workers
+// takes them out, spends 'duration' msec per 'capacity' parts, and only
+// then sends the batch's PRODUCTION_MSG. A full queue blocks the pushing
+// sub-factory, so a slow assembly stage throttles manufacturing.
+//---------------------------------------------------------------------
+
+#include <stdint.h>
+
+#include "wrappers.h"
+#include "ioengine.h"
+#include "trace.h"
+#include "journal.h"
+#include "assembly.h"
+
+int asmOn = 0 ;
+
+static asmBatch  ring[ ASM_QUEUE ] ;
+static int       head , tail ,          /* protected by lock                */
+                 depth ;
+static sem_t     lock ,                 /* the ring and the counters        */
+                 slotsFree ,
+                 slotsFull ;
+static asmStats  stats ;                /* protected by lock                */
+static double    startMs ,
+                 lastChangeMs ,         /* when depth last changed          */
+                 depthArea ;            /* integral of depth over time      */
+
+static void *asmWorker( void *arg ) ;
+
+/*--------------------------------------------------------------------
+   Account for the time spent at the current depth, then move it.
+   Caller holds lock
+----------------------------------------------------------------------*/
+static void depthChange( int delta )
+{
+    double now = monoMs() ;
+
+    depthArea   += depth * ( now - lastChangeMs ) ;
+    lastChangeMs = now ;
+    depth       += delta ;
+    if ( depth > stats.maxDepth )
+        stats.maxDepth = depth ;
+}
+
+/*--------------------------------------------------------------------
+   Start 'workers' assembly/QA threads. They run until the process exits
+----------------------------------------------------------------------*/
+void asmStart( int workers , int capacity , int duration )
+{
+    if ( workers < 1 || workers > ASM_MAXWORKERS || capacity < 1 || duration < 0 )
+        err_quit( "Assembly stage needs 1..32 workers, capacity >= 1, duration >= 0\n" ) ;
+
+    Sem_init( &lock      , 0 , 1 ) ;
+    Sem_init( &slotsFree , 0 , ASM_QUEUE ) ;
+    Sem_init( &slotsFull , 0 , 0 ) ;
+
+    stats.workers  = workers ;
+    stats.capacity = capacity ;
+    stats.duration = duration ;
+    startMs = lastChangeMs = monoMs() ;
+    asmOn   = 1 ;
+
+    for ( long i = 1 ; i <= workers ; i++ )
+    {
+        pthread_t tid ;
+        Pthread_create( &tid , NULL , asmWorker , (void *) i ) ;
+        Pthread_detach( tid ) ;
+    }
+}
+
+/*--------------------------------------------------------------------
+   Queue a batch (copied). Blocks while the queue is full
+----------------------------------------------------------------------*/
+double asmSubmit( asmBatch *b )
+{
+    double stalled = 0 ;
+
+    if ( sem_trywait( &slotsFree ) < 0 )
+    {
+        double t = monoMs() ;
+        Sem_wait( &slotsFree ) ;
+        stalled = monoMs() - t ;
+    }
+
+    Sem_wait( &lock ) ;
+    ring[ tail ] = *b ;
+    tail = ( tail + 1 ) % ASM_QUEUE ;
+    depthChange( +1 ) ;
+    stats.stallMs += stalled ;
+    Sem_post( &lock ) ;
+
+    Sem_post( &slotsFull ) ;
+    return stalled ;
+}
+
+//------------------
+
+void asmGetStats( asmStats *st )
+{
+    Sem_wait( &lock ) ;
+    depthChange( 0 ) ;
+    *st = stats ;
+    st->uptimeMs  = lastChangeMs - startMs ;
+    st->meanDepth = st->uptimeMs > 0 ? depthArea / st->uptimeMs : 0 ;
+    Sem_post( &lock ) ;
+}
+
+/*--------------------------------------------------------------------
+   Worker: assemble one batch at a time, then report it to the client
+----------------------------------------------------------------------*/
+static void *asmWorker( void *arg )
+{
+    asmBatch b ;
+
+    traceThreadName( "assembly %ld" , (long) arg ) ;
+
+    while ( 1 )
+    {
+        uint64_t tr = traceNow() ;
+        if ( sem_trywait( &slotsFull ) < 0 )
+        {
+            traceFlush() ;          // the queue is empty: this wait may be long
+            Sem_wait( &slotsFull ) ;
+        }
+
+        Sem_wait( &lock ) ;
+        b    = ring[ head ] ;
+        head = ( head + 1 ) % ASM_QUEUE ;
+        depthChange( -1 ) ;
+        Sem_post( &lock ) ;
+
+        Sem_post( &slotsFree ) ;
+
+        unsigned id = ntohl( b.msg.orderID ) ;
+        traceSpan( "await batch" , tr , id ) ;
+
+        // One pass per 'capacity' parts
+        tr = traceNow() ;
+        double   t      = monoMs() ;
+        uint64_t passes = ( b.parts + stats.capacity - 1 ) / stats.capacity ;
+        Msleep( passes * stats.duration ) ;
+        double   busy   = monoMs() - t ;
+        traceSpan( "assemble" , tr , id ) ;
+
+        // The batch is only made once it has passed QA
+        struct timespec doneAt ;
+        clock_gettime( CLOCK_REALTIME , &doneAt ) ;
+        b.msg.makeUs = htonl( usBetween( &b.claimAt , &doneAt ) ) ;
+
+        tr = traceNow() ;
+        if ( journalOn )
+            journalSync( journalLog( JR_CLAIM , b.to , id ,
+                                     ntohl( b.msg.facID ) , b.parts ) ) ;
+        stampSend( &b.msg ) ;
+        ioSend( &b.msg , b.to ) ;
+        Sem_post( b.done ) ;
+        traceSpan( "send" , tr , id ) ;
+
+        Sem_wait( &lock ) ;
+        stats.batches++ ;
+        stats.parts  += b.parts ;
+        stats.busyMs += busy ;
+        Sem_post( &lock ) ;
+    }
+
+    return NULL ;
+}
@@ -0,0 +1,50 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : assembly.h
+//---------------------------------------------------------------------
+
+#ifndef  ASSEMBLY_H
+#define  ASSEMBLY_H
+
+#include <stdint.h>
+#include <time.h>
+#include <semaphore.h>
+#include <netinet/in.h>
+
+#include "message.h"
+
+#define ASM_QUEUE       64      /* batches waiting for assembly/QA        */
+#define ASM_MAXWORKERS  32
+
+/* ------------- One manufactured batch on its way to assembly ----------- */
+typedef struct {
+    msgBuf              msg ;        /* PRODUCTION_MSG, sent once assembled */
+    struct sockaddr_in *to ;         /* the order's client                  */
+    sem_t              *done ;       /* posted after the message is sent    */
+    uint64_t            parts ;
+    struct timespec     claimAt ;    /* start of the batch, for makeUs      */
+} asmBatch ;
+
+/* ---------------- Stage counters since asmStart() ---------------------- */
+typedef struct {
+    int            workers ,
+                   capacity ,       /* parts per assembly pass             */
+                   duration ;       /* msec per pass                       */
+    unsigned long  batches ;
+    uint64_t       parts ;
+    double         uptimeMs ,
+                   busyMs ,         /* summed over workers                 */
+                   stallMs ,        /* producers blocked on a full queue   */
+                   meanDepth ;      /* time-weighted batches queued        */
+    int            maxDepth ;
+} asmStats ;
+
+extern int asmOn ;
+
+void    asmStart( int workers , int capacity , int duration ) ;
+double  asmSubmit( asmBatch *b ) ;     /* returns msec spent blocked */
+void    asmGetStats( asmStats *st ) ;
+
+#endif
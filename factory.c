@@ -5,6 +5,8 @@
 // File Name  : factory.c
 //---------------------------------------------------------------------
 
+#define _GNU_SOURCE             /* sem_clockwait() */
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -19,46 +21,147 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <glob.h>
+#include <inttypes.h>
 
 #include "wrappers.h"
 #include "message.h"
+#include "handoff.h"
+#include "slab.h"
+#include "session.h"
+#include "ioengine.h"
+#include "trace.h"
+#include "assembly.h"
+#include "stock.h"
+#include "ratelimit.h"
+#include "journal.h"
 
 #define MAXSTR      200
 #define IPSTRLEN    50
 #define SEM_NAME    "/Team25_mutex"
 
+/* Claims are batched so an order takes about this many rounds of claims
+   no matter how large it is; small orders keep one capacity per claim  */
+#define CLAIM_ROUNDS    32
+
+#define MAXORDERS       64     /* orders manufactured concurrently */
+#define WAIT_RETRY_MS   250    /* a client waiting for a context re-asks */
+#define TIMED_ORDERS    1024   /* completion times kept for percentiles */
+
 typedef struct sockaddr SA;
+typedef struct orderCtx orderCtx;
 
 /* ---------------- Per-sub-factory info that main collects ---------------- */
-typedef struct {
+typedef struct FactoryInfo {
     int factoryID;      // 1..N
     int capacity;       // max parts per iteration (10..50)
     int duration;       // msec per iteration (500..1200)
-    int partsMade;      // total parts this factory made
-    int iterations;     // number of iterations this factory ran
+    uint64_t partsMade; // total parts this factory made
+    int iterations;     // number of iterations (claims) this factory ran
+    orderCtx *order;    // the order this sub-factory works on
+    struct timespec readyAt;    // when it last became free to claim work
+    double busyMs;      // manufacturing time over all iterations
+    double stallMs;     // blocked on a full assembly queue
+    int batchesQueued;  // batches handed to the assembly stage
+    sem_t assembled;    // posted as each of them is sent
+    int finished;       // sent its COMPLETION_MSG before a restart
+
+    // Hedging: the claim being made, raced by an idle sub-factory.
+    // Protected by the order's lock
+    sem_t cancel;       // posted when the other side of a race wins
+    uint64_t inFlight;  // parts of the claim being made, 0 = none
+    double dueMs;       // when it should be done (monoMs)
+    struct FactoryInfo *hedgedBy;   // racing it, or NULL
+    int resolved;       // somebody finished it first
+    int hedgesWon;      // other sub-factories' claims we made sooner
+    int hedgesLost;     // claims we made for nothing
+    double savedMs;     // how much sooner our won hedges were done
+    double wastedMs;    // manufacturing time of lost claims
 } FactoryInfo;
 
+/* ------------- One order in progress, drawn from orderPool -------------- */
+struct orderCtx {
+    int       inUse;
+    sem_t     lock;             // protects remainsToMake and the claims
+    uint64_t  orderSize;
+    uint64_t  remainsToMake;
+    uint64_t  claimUnits;       // capacity-units per claim for this order
+    uint64_t  fromStock;        // parts served from stock, not made
+    rlClient *rl;               // the client's rate limits, or NULL
+    int       resumed;          // rebuilt from the journal after a restart
+    int       stockSent;        // the fromStock PRODUCTION_MSG went out
+    unsigned  orderID;
+    int       numFac;
+    struct sockaddr_in client;
+    struct timespec recvAt;     // REQUEST_MSG received
+    session  *sess;
+    pthread_t   tids[MAXFACTORIES + 1];
+    FactoryInfo finfo[MAXFACTORIES + 1];
+};
+
 /* ------------- Globals shared with threads (protected as needed) --------- */
 
-// Mutex used when accessing/adjusting remaining work
+// Mutex protecting the session table, the order pool and the counters
 sem_t *mutex = NULL;
 
-int   remainsToMake = 0;     // protected by mutex
-int   actuallyMade   = 0;
-int   numActiveFactories = 1;
-int   orderSize = 0;
+slab  orderPool;             // MAXORDERS order contexts
+int   activeOrders = 0;      // protected by mutex
 
 int sd;                      // server socket descriptor
 struct sockaddr_in srvrSkt;  // address of this server
-struct sockaddr_in clntSkt;  // remote client's socket
+struct sockaddr_in clntSkt;  // remote client's socket (last request)
+
+/* ------------------- Hot-restart (socket hand-off) state ----------------- */
+char  semName[MAXSTR] = SEM_NAME;  // generation 0 keeps the classic name
+int   generation    = 0;     // number of hand-offs before this process
+long  ordersServed  = 0;     // protected by mutex
+long  duplicates    = 0;     // repeated REQUEST_MSGs, protected by mutex
+int   numFac        = 1;     // N, for the hand-off snapshot
+int   handoffFd     = -1;    // listening Unix socket for a replacement
+int   prevLink      = -1;    // to the generation we took over from
+handoffSession *inherited = NULL;  // orders the previous generation drains
+int   nInherited    = 0;
+int   handingOff    = 0;     // admit no order until acked, by mutex
+handoffSession handedOff[HANDOFF_MAXSESS];  // handoffListener only
+char *journalPath   = NULL;  // -J: resumable order journal
+int   wakeFd[2] = {-1, -1};  // handoffListener, goodbye -> main: stop receiving
+volatile int draining = 0;   // set once our socket was handed off
+volatile sig_atomic_t stopSignal = 0;  // SIGINT/SIGTERM caught
+
+/* ---------------------- Hedging the final claims ------------------------ */
+uint64_t hedgeParts = 0;     // race claims of at most this many parts
+double   doneTimes[TIMED_ORDERS];  // order-to-completion mSec, by mutex
+long     timedOrders   = 0;
+
+/* ------------------------------ Receive mode ---------------------------- */
+int   busyPollUs    = 0;     // spin this long before blocking, 0 = never
+unsigned long rxSpun    = 0; // requests caught while spinning (main only)
+unsigned long rxBlocked = 0; // ... that needed a wakeup
 
 /* ------------------------------------------------------------------------ */
 
-int minimum(int a, int b)
+uint64_t minimum(uint64_t a, uint64_t b)
 {
     return (a <= b ? a : b);
 }
 
+/* Stock figures for an ORDR_CONFIRM, clamped to their 32-bit fields */
+void setStockFields(msgBuf *m, uint64_t fromStock)
+{
+    uint64_t left = stockLevel();
+
+    m->fromStock = htonl(fromStock > UINT32_MAX ? UINT32_MAX : (uint32_t) fromStock);
+    m->stockLeft = htonl(left > UINT32_MAX ? UINT32_MAX : (uint32_t) left);
+}
+
+int cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
 void factLog(char *str)
 {
     printf("%s", str);
@@ -67,23 +170,60 @@ void factLog(char *str)
 
 /* ----------------------------- Signal handler --------------------------- */
 
+// Only async-signal-safe work here: main notices and calls shutDown()
 void goodbye(int sig)
+{
+    int saved = errno;
+
+    stopSignal = sig;
+    // A failed write is harmless: main still sees stopSignal when it
+    // next looks
+    if (wakeFd[1] >= 0) {
+        ssize_t r = write(wakeFd[1], "x", 1);
+        (void) r;
+    }
+    errno = saved;
+}
+
+/* ------------------------------------------------------------------------
+   Asked to terminate: called by main once goodbye() has woken it
+   ------------------------------------------------------------------------ */
+void shutDown(void)
 {
     /* Mission Accomplished */
     printf("\n### I (%d) have been nicely asked to TERMINATE. goodbye\n\n",
            getpid());
 
-    // Tell the current client (if any) that the protocol ended abruptly
+    // Tell every client with an order in progress that the protocol
+    // ended abruptly. Journaled orders are not lost: a restarted
+    // factory finishes them, so their clients keep waiting
     msgBuf errorBuf;
     memset(&errorBuf, 0, sizeof(errorBuf));
     errorBuf.purpose = htonl(PROTOCOL_ERR);
-    sendto(sd, &errorBuf, sizeof(errorBuf), 0,
-           (SA *) &clntSkt, sizeof(clntSkt));
+
+    if (journalOn)
+        printf("Orders in progress are in the journal; a restart resumes them\n\n");
+
+    if (mutex != NULL)
+        Sem_wait(mutex);
+    for (int i = 0; !journalOn && orderPool.mem != NULL && i < MAXORDERS; i++) {
+        orderCtx *ctx = slabAt(&orderPool, i);
+        if (!ctx->inUse)
+            continue;
+        errorBuf.orderID = htonl(ctx->orderID);
+        sendto(sd, &errorBuf, sizeof(errorBuf), 0,
+               (SA *) &ctx->client, sizeof(ctx->client));
+    }
+    if (mutex != NULL)
+        Sem_post(mutex);
+
+    // Includes what the threads still working have recorded so far
+    traceClose();
 
     // Close and unlink mutex
     if (mutex != NULL) {
         Sem_close(mutex);
-        Sem_unlink(SEM_NAME);
+        Sem_unlink(semName);
     }
 
     // Close socket
@@ -95,8 +235,318 @@ void goodbye(int sig)
     exit(0);
 }
 
-/* ------------------------ Thread routine prototype ---------------------- */
+/* ------------------------ Thread routine prototypes --------------------- */
 void *subFactory(void *arg);
+void *orderManager(void *arg);
+void *handoffListener(void *arg);
+void *adoptPrevJournal(void *arg);
+
+/* ------------------------------------------------------------------------
+   Draw capacity and duration for the order's sub-factories and size its
+   claims for the parts in ctx->remainsToMake
+   ------------------------------------------------------------------------ */
+void planOrder(orderCtx *ctx)
+{
+    uint64_t roundCapacity = 0;
+
+    for (int i = 1; i <= ctx->numFac; i++) {
+        ctx->finfo[i].factoryID = i;
+        ctx->finfo[i].capacity  = 10 + (rand() % 41);   // [10,50]
+        ctx->finfo[i].duration  = 500 + (rand() % 701); // [500,1200]
+        ctx->finfo[i].partsMade = 0;
+        ctx->finfo[i].iterations = 0;
+        ctx->finfo[i].order     = ctx;
+        ctx->finfo[i].busyMs    = 0;
+        ctx->finfo[i].stallMs   = 0;
+        ctx->finfo[i].batchesQueued = 0;
+        ctx->finfo[i].finished  = 0;
+        ctx->finfo[i].inFlight  = 0;
+        ctx->finfo[i].hedgedBy  = NULL;
+        ctx->finfo[i].resolved  = 0;
+        ctx->finfo[i].hedgesWon = 0;
+        ctx->finfo[i].hedgesLost = 0;
+        ctx->finfo[i].savedMs   = 0;
+        ctx->finfo[i].wastedMs  = 0;
+        roundCapacity += ctx->finfo[i].capacity;
+    }
+
+    Sem_init(&ctx->lock, 0, 1);
+
+    // Batch enough capacity-units per claim to keep the number of
+    // claims (locks and PRODUCTION_MSGs) near N * CLAIM_ROUNDS
+    uint64_t perRound = roundCapacity * CLAIM_ROUNDS;
+    ctx->claimUnits = ctx->remainsToMake / perRound
+                      + (ctx->remainsToMake % perRound != 0);
+    if (ctx->claimUnits < 1)
+        ctx->claimUnits = 1;
+}
+
+/* ------------------------------------------------------------------------
+   Journal file of a generation: the -J name itself for generation 0
+   ------------------------------------------------------------------------ */
+void journalName(char *path, int gen)
+{
+    if (gen > 0)
+        snprintf(path, MAXSTR, "%s.%d", journalPath, gen);
+    else
+        snprintf(path, MAXSTR, "%s", journalPath);
+}
+
+/* ------------------------------------------------------------------------
+   Carry on with an order the journal says a previous factory process
+   never finished. Its client still waits at the same address, so only
+   the parts not yet reported are made, by the sub-factories that had
+   not yet sent their COMPLETION_MSG
+   ------------------------------------------------------------------------ */
+void resumeOrder(jrOrder *o)
+{
+    struct sockaddr_in client;
+    char ipStr[IPSTRLEN];
+    int  facLeft = 0;
+
+    memset(&client, 0, sizeof(client));
+    client.sin_family      = AF_INET;
+    client.sin_addr.s_addr = o->ip;
+    client.sin_port        = o->port;
+    inet_ntop(AF_INET, (void *) &client.sin_addr.s_addr, ipStr, IPSTRLEN);
+
+    for (int i = 1; i <= o->numFac; i++)
+        facLeft += !o->facDone[i];
+
+    // Every COMPLETION_MSG went out; only the last record was lost
+    if (facLeft == 0) {
+        journalLog(JR_DONE, &client, o->orderID, 0, 0);
+        return;
+    }
+
+    Sem_wait(mutex);
+    session  *sess = NULL;
+    orderCtx *ctx  = slabAlloc(&orderPool);
+    if (ctx != NULL) {
+        // Handed over by a generation that died draining it: the order
+        // already has its session
+        sess = sessionFind(&client, o->orderID);
+        if (sess == NULL || sess->state != SESS_ACTIVE || sess->order != NULL)
+            sess = sessionInsert(&client, o->orderID, (time_t) (monoMs() / 1000));
+        if (sess == NULL) {
+            slabFree(&orderPool, ctx);
+            ctx = NULL;
+        }
+    }
+    if (ctx == NULL) {
+        Sem_post(mutex);
+        printf("Too many orders to resume; order %u for %s:%d dropped\n",
+               o->orderID, ipStr, ntohs(o->port));
+        return;
+    }
+
+    uint64_t done = o->fromStock + o->partsMade;
+
+    // Everything handoffListener reads is set before inUse publishes
+    // the context
+    ctx->rl        = NULL;
+    ctx->resumed   = 1;
+    ctx->stockSent = o->stockSent;
+    ctx->sess      = sess;
+    ctx->orderID   = o->orderID;
+    ctx->client    = client;
+    clock_gettime(CLOCK_REALTIME, &ctx->recvAt);
+    ctx->numFac    = o->numFac;
+    ctx->orderSize = o->orderSize;
+    ctx->fromStock = o->fromStock;
+    ctx->remainsToMake = done < o->orderSize ? o->orderSize - done : 0;
+    sess->order     = ctx;
+    sess->orderSize = o->orderSize;
+    sess->fromStock = o->fromStock;
+    sess->partsMade = 0;
+    sess->numFac    = o->numFac;
+
+    planOrder(ctx);
+    for (int i = 1; i <= o->numFac; i++) {
+        ctx->finfo[i].partsMade  = o->facParts[i];
+        ctx->finfo[i].iterations = o->facIters[i];
+        ctx->finfo[i].finished   = o->facDone[i];
+    }
+    ctx->inUse = 1;
+    activeOrders++;
+    Sem_post(mutex);
+    if (stockOn)
+        stockOrderStart();
+
+    printf("Resumed order %u for %s:%d: %" PRIu64 " of %" PRIu64
+           " parts still to make by %d of %d sub-factories\n",
+           o->orderID, ipStr, ntohs(o->port), ctx->remainsToMake,
+           o->orderSize, facLeft, o->numFac);
+
+    pthread_t mtid;
+    Pthread_create(&mtid, NULL, orderManager, ctx);
+    Pthread_detach(mtid);
+}
+
+/* ------------------------------------------------------------------------
+   Finish the orders in the journal of a factory process that is gone
+   ------------------------------------------------------------------------ */
+void adoptJournal(const char *path)
+{
+    jrOrder *unfinished;
+    int n = journalAdopt(path, &unfinished);
+
+    if (n > 0)
+        printf("Adopted journal '%s': %d unfinished order(s)\n", path, n);
+    for (int i = 0; i < n; i++)
+        resumeOrder(&unfinished[i]);
+    free(unfinished);
+}
+
+/* ------------------------------------------------------------------------
+   Remember the orders the generation we took over from is draining, so
+   a client retransmitting one of their REQUEST_MSGs is confirmed again
+   instead of getting the order made twice. They have no order context
+   here; releaseInherited() retires them once that generation is gone
+   ------------------------------------------------------------------------ */
+void inheritSessions(void)
+{
+    struct sockaddr_in client;
+    time_t now = (time_t) (monoMs() / 1000);
+    int    n;
+
+    memset(&client, 0, sizeof(client));
+    client.sin_family = AF_INET;
+
+    Sem_wait(mutex);
+    for (n = 0; n < nInherited; n++) {
+        client.sin_addr.s_addr = inherited[n].ip;
+        client.sin_port        = inherited[n].port;
+
+        session *sess = sessionInsert(&client, inherited[n].orderID, now);
+        if (sess == NULL)
+            break;
+        sess->order     = NULL;
+        sess->numFac    = inherited[n].numFac;
+        sess->orderSize = inherited[n].orderSize;
+        sess->fromStock = inherited[n].fromStock;
+        sess->partsMade = 0;
+    }
+    nInherited = n;
+    Sem_post(mutex);
+
+    if (n > 0)
+        printf("Confirming, not repeating, the %d order(s) it is draining\n", n);
+}
+
+/* ------------------------------------------------------------------------
+   The generation we took over from is gone. Whatever of its orders the
+   journal did not hand back to us, it finished: they are done here too
+   ------------------------------------------------------------------------ */
+void releaseInherited(void)
+{
+    struct sockaddr_in client;
+    time_t now = (time_t) (monoMs() / 1000);
+
+    memset(&client, 0, sizeof(client));
+    client.sin_family = AF_INET;
+
+    Sem_wait(mutex);
+    for (int i = 0; i < nInherited; i++) {
+        client.sin_addr.s_addr = inherited[i].ip;
+        client.sin_port        = inherited[i].port;
+
+        session *sess = sessionFind(&client, inherited[i].orderID);
+        if (sess != NULL && sess->state == SESS_ACTIVE && sess->order == NULL)
+            sessionIdle(sess, now);
+    }
+    nInherited = 0;
+    Sem_post(mutex);
+
+    free(inherited);
+    inherited = NULL;
+}
+
+/* ------------------------------------------------------------------------
+   Wait for the generation we took over from to exit, drained or not,
+   then adopt its journal
+   ------------------------------------------------------------------------ */
+void *adoptPrevJournal(void *arg)
+{
+    char    c;
+    ssize_t n;
+    (void) arg;
+
+    do
+        n = read(prevLink, &c, 1);
+    while (n > 0 || (n < 0 && errno == EINTR));
+    close(prevLink);
+
+    if (journalOn) {
+        char path[MAXSTR];
+        journalName(path, generation - 1);
+        adoptJournal(path);
+    }
+    releaseInherited();
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------
+   Block until a datagram arrives or our socket has been handed off.
+   Returns 1 with the datagram in *m, or 0 once we are draining and every
+   datagram the I/O engine had already taken off the socket was served.
+   The socket may be shared with a replacement process, so never block in
+   a receive call itself: the datagram we were woken for may already be gone.
+   ------------------------------------------------------------------------ */
+int awaitRequest(msgBuf *m, unsigned int *alen)
+{
+    struct pollfd pfd[2];
+
+    *alen = sizeof(clntSkt);
+
+    while (1) {
+        if (stopSignal)
+            shutDown();
+
+        if (draining) {
+            ioStopRecv();
+            return ioRecv(m, &clntSkt) == 0;
+        }
+
+        // Busy-poll: a request that arrives while we spin costs no
+        // wakeup, at the price of a core kept busy
+        if (busyPollUs > 0) {
+            double until = monoMs() + busyPollUs / 1000.0;
+            do {
+                if (ioRecv(m, &clntSkt) == 0) {
+                    rxSpun++;
+                    return 1;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    err_sys("Error during recvfrom()");
+            } while (!draining && !stopSignal && monoMs() < until);
+
+            if (draining || stopSignal)
+                continue;
+        }
+
+        ioArmWait();
+        pfd[0].fd = ioWaitFd(); pfd[0].events = POLLIN;  pfd[0].revents = 0;
+        pfd[1].fd = wakeFd[0];  pfd[1].events = POLLIN;  pfd[1].revents = 0;
+
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            err_sys("Error during poll()");
+        }
+
+        if (pfd[1].revents)
+            continue;
+
+        if (ioRecv(m, &clntSkt) == 0) {
+            rxBlocked++;
+            return 1;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            err_sys("Error during recvfrom()");
+    }
+}
 
 /* ======================================================================== */
 
@@ -122,20 +572,76 @@ int main(int argc, char *argv[])
     sigactionWrapper(SIGINT,  goodbye);
     sigactionWrapper(SIGTERM, goodbye);
 
-    /* ------------- Command line: [numThreads] [port] -------------------- */
-    switch (argc) {
-        case 1:
+    /* -- Command line: [-H] [-U] [-T traceFile] [-A workers[,cap,ms]]
+          [-S highWater] [-R orders/s[,parts/s[,share]]] [-J journal]
+          [-X hedgeParts] [-P spinUsec] [numThreads] [port] */
+    int hotRestart = 0;            /* -H: take over a running factory    */
+    int ioWant = IO_CLASSIC;       /* -U: socket I/O through io_uring    */
+    char *tracePath = NULL;        /* -T: Chrome trace-event JSON output */
+    int asmWorkers  = 0,           /* -A: assembly/QA stage after making */
+        asmCapacity = 50,
+        asmDuration = 300;
+    uint64_t stockMark = 0;        /* -S: make to stock up to this level  */
+    uint64_t stockHandedOver = 0;
+    double rlOrders = 0,           /* -R: per-client rates (0 = no limit) */
+           rlParts  = 0;
+    int    rlShare  = MAXORDERS / 4;
+    int    rlWanted = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "HUT:A:S:R:J:X:P:")) != -1) {
+        switch (opt) {
+            case 'H':
+                hotRestart = 1;
+                break;
+            case 'U':
+                ioWant = IO_URING;
+                break;
+            case 'T':
+                tracePath = optarg;
+                break;
+            case 'A':
+                sscanf(optarg, "%d,%d,%d", &asmWorkers, &asmCapacity, &asmDuration);
+                break;
+            case 'S':
+                stockMark = strtoull(optarg, NULL, 10);
+                break;
+            case 'R':
+                sscanf(optarg, "%lf,%lf,%d", &rlOrders, &rlParts, &rlShare);
+                rlWanted = 1;
+                break;
+            case 'J':
+                journalPath = optarg;
+                break;
+            case 'X':
+                hedgeParts = strtoull(optarg, NULL, 10);
+                break;
+            case 'P':
+                busyPollUs = atoi(optarg);
+                break;
+            default:
+                printf("FACTORY Usage: %s [-H] [-U] [-T traceFile] [-A workers[,capacity,msec]]"
+                       " [-S highWater] [-R orders/s[,parts/s[,share]]] [-J journal]"
+                       " [-X hedgeParts] [-P spinUsec] [numThreads] [port]\n", argv[0]);
+                exit(1);
+        }
+    }
+
+    switch (argc - optind) {
+        case 0:
             break;  // use default port, N=1
-        case 2:
-            N = atoi(argv[1]);
+        case 1:
+            N = atoi(argv[optind]);
             port = 50015;
             break;
-        case 3:
-            N = atoi(argv[1]);
-            port = (unsigned short) atoi(argv[2]);
+        case 2:
+            N = atoi(argv[optind]);
+            port = (unsigned short) atoi(argv[optind + 1]);
             break;
         default:
-            printf("FACTORY Usage: %s [numThreads] [port]\n", argv[0]);
+            printf("FACTORY Usage: %s [-H] [-U] [-T traceFile] [-A workers[,capacity,msec]]"
+                   " [-S highWater] [-R orders/s[,parts/s[,share]]] [-J journal]"
+                   " [-X hedgeParts] [-P spinUsec] [numThreads] [port]\n", argv[0]);
             exit(1);
     }
 
@@ -144,47 +650,178 @@ int main(int argc, char *argv[])
     if (N > MAXFACTORIES)
         N = MAXFACTORIES;
 
+    numFac = N;
     printf("\nI will attempt to accept orders at port %d and use %d sub-factories.\n", port, N);
 
-    /* ------------------------ Set up UDP socket ------------------------- */
-    sd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sd < 0)
-        err_sys("Could not create socket.");
-
-    memset((void *) &srvrSkt, 0, sizeof(srvrSkt));
-    srvrSkt.sin_family      = AF_INET;
-    srvrSkt.sin_addr.s_addr = htonl(INADDR_ANY);
-    srvrSkt.sin_port        = htons(port);
+    char ipStr[IPSTRLEN];
 
-    if (bind(sd, (SA *) &srvrSkt, sizeof(srvrSkt)) < 0) {
-        snprintf(buf, MAXSTR, "Could not bind to port %d", port);
-        err_sys(buf);
+    if (hotRestart) {
+        /* ------------ Take over the socket of a running factory -------- */
+        handoffState st;
+        unsigned int slen = sizeof(srvrSkt);
+
+        sd = handoffReceive(port, &st, &inherited, &prevLink);
+        nInherited = st.nSessions;
+        if (getsockname(sd, (SA *) &srvrSkt, &slen) < 0)
+            err_sys("getsockname() on handed-off socket failed");
+
+        generation   = st.generation + 1;
+        ordersServed = st.ordersServed;
+        snprintf(semName, MAXSTR, "%s.%d", SEM_NAME, generation);
+
+        printf("\nTook over socket from generation %d (%d sub-factories, "
+               "%ld orders served so far)\n",
+               st.generation, st.numFac, st.ordersServed);
+        if (st.ordersActive)
+            printf("Previous generation is draining %d order(s) with %"
+                   PRIu64 " parts still to make\n",
+                   st.ordersActive, st.partsPending);
+        if (st.stock > 0)
+            printf("Inherited %" PRIu64 " parts of stock%s\n", st.stock,
+                   stockMark > 0 ? "" : " (discarded: no -S)");
+        stockHandedOver = st.stock;
+    }
+    else {
+        /* ------------------------ Set up UDP socket ----------------- */
+        sd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sd < 0)
+            err_sys("Could not create socket.");
+
+        memset((void *) &srvrSkt, 0, sizeof(srvrSkt));
+        srvrSkt.sin_family      = AF_INET;
+        srvrSkt.sin_addr.s_addr = htonl(INADDR_ANY);
+        srvrSkt.sin_port        = htons(port);
+
+        if (bind(sd, (SA *) &srvrSkt, sizeof(srvrSkt)) < 0) {
+            snprintf(buf, MAXSTR, "Could not bind to port %d", port);
+            err_sys(buf);
+        }
     }
 
-    char ipStr[IPSTRLEN];
     inet_ntop(AF_INET, (void *) &srvrSkt.sin_addr.s_addr, ipStr, IPSTRLEN);
     printf("\nBound socket %d to IP %s Port %d\n", sd, ipStr,
            ntohs(srvrSkt.sin_port));
 
+    ioInit(sd, ioWant);
+    printf("Socket I/O engine: %s\n", ioEngineName());
+
+    // Also let the kernel poll the device queue for our socket, where
+    // it allows us to
+    if (busyPollUs > 0) {
+        printf("Busy-poll receive: spin up to %d uSec before blocking\n",
+               busyPollUs);
+        if (setsockopt(sd, SOL_SOCKET, SO_BUSY_POLL, &busyPollUs,
+                       sizeof(busyPollUs)) < 0)
+            perror("SO_BUSY_POLL unavailable; spinning in user space only");
+        if (sysconf(_SC_NPROCESSORS_ONLN) < 2)
+            printf("Warning: one CPU online; spinning takes it from the"
+                   " sub-factories\n");
+    }
+
+    // One trace buffer per thread: main, managers, sub-factories, assembly
+    if (tracePath != NULL) {
+        traceOpen(tracePath, MAXORDERS * (MAXFACTORIES + 1) + ASM_MAXWORKERS + 4);
+        traceThreadName("main");
+        printf("Tracing thread timelines to '%s'\n", tracePath);
+    }
+
+    // Manufactured batches go through assembly/QA before they count
+    if (asmWorkers > 0) {
+        asmStart(asmWorkers, asmCapacity, asmDuration);
+        printf("Assembly/QA stage: %d workers, %d parts per %d mSec pass,"
+               " queue of %d batches\n",
+               asmWorkers, asmCapacity, asmDuration, ASM_QUEUE);
+    }
+
+    // Idle sub-factory capacity makes parts to stock
+    if (stockMark > 0) {
+        stockStart(stockMark, N, stockHandedOver);
+        printf("Make-to-stock: %d builders, high-water mark %" PRIu64
+               " parts\n", N, stockMark);
+    }
+
+    // No client gets more than its rates and its share of order contexts
+    if (rlWanted) {
+        rlInit(rlOrders, rlParts, rlShare);
+        printf("Per-client limits: %.1f orders/sec, %.1f parts/sec (0 = none),"
+               " %d orders at a time\n", rlOrders, rlParts, rlShare);
+    }
+
+    // Idle sub-factories race stragglers for the last parts of an order
+    if (hedgeParts > 0)
+        printf("Hedging: idle sub-factories race final claims of up to %"
+               PRIu64 " parts\n", hedgeParts);
+
     /* --------------------- Open named semaphore ------------------------ */
-    mutex = Sem_open(SEM_NAME, O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, 1);
+    mutex = Sem_open(semName, O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, 1);
+
+    /* ------------ Preallocate order contexts and the session table ----- */
+    slabInit(&orderPool, MAXORDERS, sizeof(orderCtx));
+    sessionInit();
+    inheritSessions();
+
+    /* ------------- Be ready to hand our socket to a replacement -------- */
+    pthread_t htid;
+
+    if (pipe(wakeFd) < 0)
+        err_sys("Could not create wake-up pipe");
+    handoffFd = handoffListen(ntohs(srvrSkt.sin_port));
+    Pthread_create(&htid, NULL, handoffListener, NULL);
+    Pthread_detach(htid);
 
     // Seed the random number generator once
     srand((unsigned int) time(NULL));
 
-    int forever = 1;
-    while (forever) {
+    /* ------- Open the order journal; finish what a crash cut short ----- */
+    // A replacement keeps its own journal: the previous generation is
+    // still writing to the old one while it drains
+    if (journalPath != NULL) {
+        char     jpath[MAXSTR];
+        jrOrder *unfinished;
+
+        journalName(jpath, generation);
+        int n = journalOpen(jpath, &unfinished);
+        printf("Journaling orders to '%s'; %d unfinished order(s) found\n",
+               jpath, n);
+        for (int i = 0; i < n; i++)
+            resumeOrder(&unfinished[i]);
+        free(unfinished);
+
+        // A cold start also finishes what any generation left behind
+        if (generation == 0) {
+            glob_t g;
+            snprintf(jpath, MAXSTR, "%s.*", journalPath);
+            if (glob(jpath, 0, NULL, &g) == 0) {
+                for (size_t i = 0; i < g.gl_pathc; i++) {
+                    char *end;
+                    char *sfx = g.gl_pathv[i] + strlen(journalPath) + 1;
+                    if (strtol(sfx, &end, 10) > 0 && *end == '\0')
+                        adoptJournal(g.gl_pathv[i]);
+                }
+                globfree(&g);
+            }
+        }
+    }
+
+    // Once the previous generation is gone, its journal is ours
+    if (prevLink >= 0) {
+        pthread_t atid;
+        Pthread_create(&atid, NULL, adoptPrevJournal, NULL);
+        Pthread_detach(atid);
+    }
+
+    while (1) {
         msgBuf msg1;
-        alen = sizeof(clntSkt);
         memset(&msg1, 0, sizeof(msg1));
 
         printf("\nFACTORY server ( by AIDEN SMITH, BRADEN DRAKE ) waiting for Order Requests\n\n");
 
         /* ---------------------- Receive REQUEST_MSG -------------------- */
-        if (recvfrom(sd, &msg1, sizeof(msg1), 0,
-                     (SA *) &clntSkt, &alen) < 0) {
-            err_sys("Error during recvfrom()");
-        }
+        uint64_t tr = traceNow();
+        if (!awaitRequest(&msg1, &alen))
+            break;
+        traceSpan("receive", tr, ntohl(msg1.orderID));
+        tr = traceNow();
 
         printf("FACTORY server ( by AIDEN SMITH, BRADEN DRAKE ) received: ");
         printMsg(&msg1);
@@ -194,84 +831,529 @@ int main(int argc, char *argv[])
         printf("        From IP %s Port %d\n",
                ipStr, ntohs(clntSkt.sin_port));
 
+        if (ntohl(msg1.purpose) != REQUEST_MSG)
+            continue;
+
+        /* ------------- Find or open this client's session -------------- */
+        unsigned  orderID = ntohl(msg1.orderID);
+        time_t    nowSec  = (time_t) (monoMs() / 1000);
+        orderCtx *ctx     = NULL;
+        session  *sess;
+
+        Sem_wait(mutex);
+        sessionEvict(nowSec);
+
+        // A retransmitted request: its confirmation was slow or lost.
+        // Confirm it again; the order's messages already go to this
+        // client, so an order in progress simply carries on. A waiting
+        // order's client is asking for its context again
+        sess = sessionFind(&clntSkt, orderID);
+        if (sess != NULL && sess->state != SESS_WAITING) {
+            int inProgress = (sess->state == SESS_ACTIVE);
+            duplicates++;
+            msg1.purpose = htonl(ORDR_CONFIRM);
+            msg1.numFac  = htonl(sess->numFac);
+            setOrderSize(&msg1, sess->orderSize);
+            if (stockOn)
+                setStockFields(&msg1, sess->fromStock);
+            Sem_post(mutex);
+
+            ioSend(&msg1, &clntSkt);
+            printf("        Duplicate of order %u (%s); confirmation re-sent\n",
+                   orderID, inProgress ? "in progress" : "already made");
+            continue;
+        }
+
+        // Our socket is being handed over, and the replacement would not
+        // know about an order admitted now: leave it to the client's
+        // retransmission, which reaches whoever holds the socket then
+        if (handingOff) {
+            Sem_post(mutex);
+            printf("        Hand-off in progress; order %u left for a retry\n",
+                   orderID);
+            continue;
+        }
+
+        /* ----------- Per-client rate limits and fair share ------------- */
+        // Over its limit: tell the client at once instead of queueing
+        rlClient *rl = NULL;
+        if (rlOn) {
+            unsigned retryMs = 0;
+            rl = rlClientOf(clntSkt.sin_addr.s_addr);
+
+            int verdict = rlAdmit(rl, &retryMs);
+            if (verdict != RL_ADMIT) {
+                Sem_post(mutex);
+
+                msg1.purpose = htonl(verdict == RL_DEFER ? ORDR_DEFER : PROTOCOL_ERR);
+                msg1.retryMs = htonl(retryMs);
+                ioSend(&msg1, &clntSkt);
+                printf("        Client over its limits; order %u %s\n", orderID,
+                       verdict == RL_DEFER ? "deferred" : "rejected");
+                continue;
+            }
+        }
+
+        ctx = slabAlloc(&orderPool);
+        if (sess == NULL)
+            sess = sessionInsert(&clntSkt, orderID, nowSec);
+
+        if (ctx == NULL || sess == NULL) {
+            if (ctx != NULL)
+                slabFree(&orderPool, ctx);
+
+            // Every order context is busy: the session remembers the
+            // order and the client asks again shortly. If it stops
+            // asking, the session is evicted like a finished one
+            if (sess != NULL)
+                sessionWait(sess, nowSec);
+            Sem_post(mutex);
+            if (rl != NULL)
+                rlOrderDone(rl, NULL);
+
+            if (sess != NULL) {
+                msg1.purpose = htonl(ORDR_DEFER);
+                msg1.retryMs = htonl(WAIT_RETRY_MS);
+                printf("        Every order context is busy; order %u waits\n",
+                       orderID);
+            }
+            else {
+                // Every session is in use: refuse the order
+                msg1.purpose = htonl(PROTOCOL_ERR);
+                printf("        Too many orders in progress; order refused\n");
+            }
+            ioSend(&msg1, &clntSkt);
+            continue;
+        }
+        sessionStart(sess, nowSec);
+
+        ctx->rl      = rl;
+        ctx->resumed = 0;
+        ctx->sess    = sess;
+        ctx->orderID = orderID;
+        ctx->client  = clntSkt;
+        clock_gettime(CLOCK_REALTIME, &ctx->recvAt);
+        ctx->numFac  = N;
+        sess->order     = ctx;
+        sess->orderSize = getOrderSize(&msg1);
+        sess->partsMade = 0;
+        sess->numFac    = N;
+        Sem_post(mutex);
+
         /* --------------------- Initialize order state ------------------ */
-        orderSize      = (int) ntohl(msg1.orderSize);
-        remainsToMake  = orderSize;
-        numActiveFactories = N;
+        ctx->orderSize     = getOrderSize(&msg1);
+        ctx->fromStock     = 0;
+        if (stockOn) {
+            stockOrderStart();
+            ctx->fromStock = stockTake(ctx->orderSize);
+        }
+        ctx->remainsToMake = ctx->orderSize - ctx->fromStock;
+
+        /* -------- Draw random params for N sub-factory threads ---------- */
+        planOrder(ctx);
+
+        // Publish the order only once its lock and counts are ready:
+        // handoffListener and goodbye() walk every context in use
+        Sem_wait(mutex);
+        sess->fromStock = ctx->fromStock;
+        ctx->inUse      = 1;
+        activeOrders++;
+        Sem_post(mutex);
+
+        // Confirm only what a restart could finish
+        if (journalOn)
+            journalSync(journalAdmit(&clntSkt, orderID, ctx->orderSize,
+                                     ctx->fromStock, N));
 
         /* -------------------- Send ORDR_CONFIRM ------------------------ */
         msg1.purpose = htonl(ORDR_CONFIRM);
         msg1.numFac  = htonl(N);
-        sendto(sd, &msg1, sizeof(msg1), 0, (SA *) &clntSkt, alen);
+        if (stockOn)
+            setStockFields(&msg1, ctx->fromStock);
+        ioSend(&msg1, &clntSkt);
 
         printf("\n\nFACTORY ( by AIDEN SMITH, BRADEN DRAKE ) sent this Order Confirmation to the client ");
         printMsg(&msg1);
         puts("");
 
-        /* ----------------------- Start timing -------------------------- */
-        struct timeval startTime, endTime;
-        gettimeofday(&startTime, NULL);
+        traceSpan("confirm", tr, orderID);
 
-        /* -------- Create N sub-factory threads with random params ------ */
-        pthread_t   tids[MAXFACTORIES + 1];
-        FactoryInfo finfo[MAXFACTORIES + 1];
+        /* ------- Hand the order to its manager; keep receiving --------- */
+        pthread_t mtid;
+        Pthread_create(&mtid, NULL, orderManager, ctx);
+        Pthread_detach(mtid);
+    }
 
-        for (int i = 1; i <= N; i++) {
-            finfo[i].factoryID = i;
-            finfo[i].capacity  = 10 + (rand() % 41);   // [10,50]
-            finfo[i].duration  = 500 + (rand() % 701); // [500,1200]
-            finfo[i].partsMade = 0;
-            finfo[i].iterations = 0;
+    /* ---------- We only get here after handing off our socket ---------- */
+    int pending;
+    do {
+        if (stopSignal)
+            shutDown();
+        Sem_wait(mutex);
+        pending = activeOrders;
+        Sem_post(mutex);
+        if (pending > 0)
+            Usleep(100 * 1000);
+    } while (pending > 0);
 
-            printf("Created Factory Thread # %2d with capacity = %3d parts"
-                   " & duration = %4d mSec\n",
-                   i, finfo[i].capacity, finfo[i].duration);
+    printf("\n### I (%d) handed my socket to a replacement and drained all"
+           " orders. goodbye\n\n", getpid());
 
-            Pthread_create(&tids[i], NULL, subFactory, &finfo[i]);
-        }
+    traceClose();
+
+    Sem_close(mutex);
+    Sem_unlink(semName);
+
+    if (close(sd) < 0) {
+        perror("Error closing socket.");
+        exit(1);
+    }
 
-        /* ------------------- Wait for all sub-factories ---------------- */
+    return 0;
+}
+
+/* ======================================================================== */
+/*                 Order manager: runs one order to completion              */
+/* ======================================================================== */
+
+void *orderManager(void *arg)
+{
+    orderCtx *ctx = (orderCtx *) arg;
+    int       N   = ctx->numFac;
+
+    traceThreadName("order %u manager", ctx->orderID);
+
+    /* ----------------------- Start timing -------------------------- */
+    struct timeval startTime, endTime;
+    gettimeofday(&startTime, NULL);
+    uint64_t tr = traceNow();
+
+    /* ------------- Deliver what came from stock at once ------------ */
+    // Credited to sub-factory 1 so every client counts it. Journaled
+    // like a claim, so a resumed order sends it exactly when it never went
+    if (ctx->fromStock > 0 && !ctx->stockSent) {
+        msgBuf msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.purpose = htonl(PRODUCTION_MSG);
+        msg.facID   = htonl(1);
+        msg.orderID = htonl(ctx->orderID);
+        setPartsMade(&msg, ctx->fromStock);
+        if (journalOn)
+            journalSync(journalLog(JR_CLAIM, &ctx->client, ctx->orderID,
+                                   0, ctx->fromStock));
+        stampSend(&msg);
+        ioSend(&msg, &ctx->client);
+        ctx->stockSent = 1;
+
+        printf("Served %" PRIu64 " of %" PRIu64 " parts from stock\n",
+               ctx->fromStock, ctx->orderSize);
+
+        // Stock is not free: it counts against the client's parts rate
+        if (ctx->rl != NULL)
+            rlTakeParts(ctx->rl, ctx->fromStock);
+        traceSpan("from stock", tr, ctx->orderID);
+        tr = traceNow();
+    }
+
+    /* ----------------- Create N sub-factory threads ---------------- */
+    if (ctx->claimUnits > 1)
+        printf("Large order: each claim batches %" PRIu64 " capacity-units\n",
+               ctx->claimUnits);
+
+    for (int i = 1; i <= N; i++) {
+        if (ctx->finfo[i].finished)
+            continue;
+        printf("Created Factory Thread # %2d with capacity = %3d parts"
+               " & duration = %4d mSec\n",
+               i, ctx->finfo[i].capacity, ctx->finfo[i].duration);
+
+        ctx->finfo[i].readyAt = ctx->recvAt;
+        Sem_init(&ctx->finfo[i].assembled, 0, 0);
+        Sem_init(&ctx->finfo[i].cancel, 0, 0);
+
+        Pthread_create(&ctx->tids[i], NULL, subFactory, &ctx->finfo[i]);
+    }
+
+    traceSpan("spawn", tr, ctx->orderID);
+
+    /* ------------------- Wait for all sub-factories ---------------- */
+    tr = traceNow();
+    for (int i = 1; i <= N; i++) {
+        if (ctx->finfo[i].finished)
+            continue;
+        Pthread_join(ctx->tids[i], NULL);
+        Sem_destroy(&ctx->finfo[i].assembled);
+        Sem_destroy(&ctx->finfo[i].cancel);
+    }
+    traceSpan("join", tr, ctx->orderID);
+
+    // Nothing left to resume; no need to wait for the disk
+    if (journalOn)
+        journalLog(JR_DONE, &ctx->client, ctx->orderID, 0, 0);
+
+    /* ------------------------ Stop timing -------------------------- */
+    gettimeofday(&endTime, NULL);
+    double elapsed_ms =
+        (endTime.tv_sec  - startTime.tv_sec)  * 1000.0 +
+        (endTime.tv_usec - startTime.tv_usec) / 1000.0;
+
+    /* ------------- Retire the session, recycle the context --------- */
+    // Keep what the report needs, so the context is free for the next
+    // order as soon as the last sub-factory is done
+    FactoryInfo finfo[MAXFACTORIES + 1];
+    unsigned    orderID    = ctx->orderID;
+    uint64_t    orderSize  = ctx->orderSize;
+    uint64_t    fromStock  = ctx->fromStock;
+    rlClient   *rl         = ctx->rl;
+    int         resumed    = ctx->resumed;
+    struct sockaddr_in client = ctx->client;
+    uint64_t    grandTotal = fromStock;
+
+    memcpy(finfo, ctx->finfo, sizeof(finfo));
+    for (int i = 1; i <= N; i++)
+        grandTotal += finfo[i].partsMade;
+
+    Sem_wait(mutex);
+    ctx->sess->partsMade = grandTotal;
+    sessionIdle(ctx->sess, (time_t) (monoMs() / 1000));
+    Sem_destroy(&ctx->lock);
+    ctx->inUse = 0;
+    slabFree(&orderPool, ctx);
+    activeOrders--;
+    ordersServed++;
+    long dupes = duplicates;
+
+    // Recent completion times, for the tail percentiles
+    double times[TIMED_ORDERS];
+    doneTimes[timedOrders++ % TIMED_ORDERS] = elapsed_ms;
+    int timed = timedOrders < TIMED_ORDERS ? (int) timedOrders : TIMED_ORDERS;
+    memcpy(times, doneTimes, timed * sizeof(double));
+    Sem_post(mutex);
+
+    qsort(times, timed, sizeof(double), cmpDouble);
+
+    if (stockOn)
+        stockOrderDone();
+    rlClient use;
+    if (rl != NULL)
+        rlOrderDone(rl, &use);
+
+    /* ---------------------- Print summary report ------------------- */
+    tr = traceNow();
+    flockfile(stdout);
+    printf("\n****** FACTORY Server ( by Aiden Smith and Braden Drake ) Summary Report ******\n");
+    if (orderID != 0)
+        printf("    Order ID %u%s\n", orderID,
+               resumed ? " (resumed from the journal)" : "");
+    printf("    Sub-Factory      Parts Made      Iterations\n");
+
+    for (int i = 1; i <= N; i++) {
+        printf("           %4d        %8" PRIu64 "            %4d\n",
+               finfo[i].factoryID,
+               finfo[i].partsMade,
+               finfo[i].iterations);
+    }
+
+    if (stockOn)
+        printf("      from stock        %8" PRIu64 "   (stock now %" PRIu64
+               " of %" PRIu64 ")\n",
+               fromStock, stockLevel(), stockHighWater());
+
+    printf("====================================================\n");
+    printf("Grand total parts made   = %5" PRIu64 "   vs  order size of %5" PRIu64 "\n",
+           grandTotal, orderSize);
+    printf("\nOrder-to-Completion time = %.1f milliSeconds\n",
+           elapsed_ms);
+    printf("Order-to-Completion so far: p50 %.1f  p99 %.1f milliSeconds"
+           " over the last %d orders\n",
+           times[timed / 2], times[(timed * 99) / 100], timed);
+    printf("Duplicate requests so far: %ld, none manufactured again\n", dupes);
+
+    if (hedgeParts > 0) {
+        int    won = 0, lost = 0;
+        double savedMs = 0, wastedMs = 0;
         for (int i = 1; i <= N; i++) {
-            Pthread_join(tids[i], NULL);
+            won      += finfo[i].hedgesWon;
+            lost     += finfo[i].hedgesLost;
+            savedMs  += finfo[i].savedMs;
+            wastedMs += finfo[i].wastedMs;
         }
+        // Every race has one loser
+        printf("Hedged final claims: %d raced, %d won by the idle sub-factory;"
+               " %.1f mSec of tail cut, %.1f mSec of work cancelled\n",
+               lost, won, savedMs, wastedMs);
+    }
 
-        /* ------------------------ Stop timing -------------------------- */
-        gettimeofday(&endTime, NULL);
-        double elapsed_ms =
-            (endTime.tv_sec  - startTime.tv_sec)  * 1000.0 +
-            (endTime.tv_usec - startTime.tv_usec) / 1000.0;
-
-        /* ---------------------- Print summary report ------------------- */
-        int grandTotal = 0;
+    if (rl != NULL) {
+        char ipStr[IPSTRLEN];
 
-        printf("\n****** FACTORY Server ( by Aiden Smith and Braden Drake ) Summary Report ******\n");
-        printf("    Sub-Factory      Parts Made      Iterations\n");
+        inet_ntop(AF_INET, (void *) &client.sin_addr.s_addr, ipStr, IPSTRLEN);
+        printf("Client %s so far: %lu orders admitted, %lu deferred, %lu rejected;"
+               " %" PRIu64 " parts, %.1f mSec throttled\n",
+               ipStr, use.admitted, use.deferred, use.rejected,
+               use.parts, use.throttledMs);
+    }
 
+    if (asmOn) {
+        double busyMs = 0, stallMs = 0;
         for (int i = 1; i <= N; i++) {
-            grandTotal += finfo[i].partsMade;
-            printf("           %4d        %8d            %4d\n",
-                   finfo[i].factoryID,
-                   finfo[i].partsMade,
-                   finfo[i].iterations);
+            busyMs  += finfo[i].busyMs;
+            stallMs += finfo[i].stallMs;
         }
 
-        printf("====================================================\n");
-        printf("Grand total parts made   = %5d   vs  order size of %5d\n",
-               grandTotal, orderSize);
-        printf("\nOrder-to-Completion time = %.1f milliSeconds\n\n",
-               elapsed_ms);
+        // Assembly is shared by all orders, so its figures are cumulative
+        asmStats as;
+        asmGetStats(&as);
+        printf("Pipeline stages:\n");
+        printf("    Manufacture  : %8.1f parts/sec, %2d sub-factories %3.0f%% busy,"
+               " %.1f mSec stalled on a full queue\n",
+               grandTotal * 1000.0 / elapsed_ms, N,
+               100.0 * busyMs / (N * elapsed_ms), stallMs);
+        printf("    Assembly/QA  : %8.1f parts/sec, %2d workers       %3.0f%% busy,"
+               " queue mean %.1f max %d of %d batches (all orders so far)\n",
+               as.parts * 1000.0 / as.uptimeMs, as.workers,
+               100.0 * as.busyMs / (as.workers * as.uptimeMs),
+               as.meanDepth, as.maxDepth, ASM_QUEUE);
     }
 
-    /* --------------- Clean up if we ever break out of loop ------------- */
-    Sem_close(mutex);
-    Sem_unlink(SEM_NAME);
+    if (journalOn) {
+        jrStats js;
+        journalGetStats(&js);
+        printf("Journal so far: %lu records in %lu syncs (%.1f per sync),"
+               " %lu compactions\n",
+               js.records, js.syncs,
+               js.syncs ? (double) js.records / js.syncs : 0.0,
+               js.compactions);
+    }
 
-    if (close(sd) < 0) {
-        perror("Error closing socket.");
-        exit(1);
+    ioStats io;
+    ioGetStats(&io);
+    unsigned long dgrams = io.datagramsIn + io.datagramsOut;
+    printf("Socket I/O (%s) so far: %lu syscalls for %lu datagrams in,"
+           " %lu out (%.2f per datagram), %lu dropped, %lu sends failed\n",
+           ioEngineName(), io.syscalls, io.datagramsIn, io.datagramsOut,
+           dgrams ? (double) io.syscalls / dgrams : 0.0, io.drops,
+           io.sendErrors);
+
+    // What the receive mode costs: spinning shows up as CPU time
+    struct rusage ru;
+    char   mode[MAXSTR];
+    getrusage(RUSAGE_SELF, &ru);
+    if (busyPollUs > 0)
+        snprintf(mode, MAXSTR, "busy-poll %d uSec", busyPollUs);
+    else
+        snprintf(mode, MAXSTR, "blocking");
+    printf("Receive (%s) so far: %lu requests caught spinning, %lu after"
+           " a wakeup; CPU %.2f s user + %.2f s sys\n\n",
+           mode, rxSpun, rxBlocked,
+           ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6);
+    funlockfile(stdout);
+    traceSpan("report", tr, orderID);
+
+    fflush(stdout);
+    traceThreadEnd();
+    return NULL;
+}
+
+/* ======================================================================== */
+/*                  Hedging: racing the last claims of an order             */
+/* ======================================================================== */
+
+/* ------------------------------------------------------------------------
+   The claim an idle sub-factory should race, or NULL: of the claims no
+   bigger than hedgeParts that nobody races yet, the one due last that
+   'info' would finish sooner. Caller holds the order's lock
+   ------------------------------------------------------------------------ */
+FactoryInfo *pickHedge(FactoryInfo *info)
+{
+    orderCtx    *order = info->order;
+    FactoryInfo *best  = NULL;
+    double       now   = monoMs();
+
+    for (int i = 1; i <= order->numFac; i++) {
+        FactoryInfo *f = &order->finfo[i];
+        if (f == info || f->inFlight == 0 || f->inFlight > hedgeParts
+            || f->resolved || f->hedgedBy != NULL)
+            continue;
+
+        uint64_t units = (f->inFlight + info->capacity - 1) / info->capacity;
+        if (now + units * info->duration >= f->dueMs)
+            continue;
+        if (best == NULL || f->dueMs > best->dueMs)
+            best = f;
     }
+    return best;
+}
 
-    return 0;
+/* Manufacture for 'ms' milliSeconds, or until the other side of a
+   hedge race finishes first */
+void makeFor(FactoryInfo *info, uint64_t ms)
+{
+    struct timespec until;
+
+    if (hedgeParts == 0) {
+        Msleep(ms);
+        return;
+    }
+
+    // Monotonic, like the dueMs the hedge race is judged by: stepping
+    // the wall clock must not stretch or cut a claim short
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec  += ms / 1000;
+    until.tv_nsec += (long) (ms % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec  += 1;
+        until.tv_nsec -= 1000000000;
+    }
+
+    while (sem_clockwait(&info->cancel, CLOCK_MONOTONIC, &until) < 0) {
+        if (errno == ETIMEDOUT)
+            return;
+        if (errno != EINTR)
+            err_sys("sem_clockwait failed");
+    }
+}
+
+/* ------------------------------------------------------------------------
+   Whoever finishes a raced claim first gets the credit and cancels the
+   other side. 'target' is the claim's owner when 'info' hedged it, or
+   NULL when the claim is info's own. Returns 1 if 'info' won.
+   Once nothing is left to claim no owner starts another claim, so a
+   'resolved' flag can only be about the race at hand
+   ------------------------------------------------------------------------ */
+int settleRace(FactoryInfo *info, FactoryInfo *target, uint64_t parts)
+{
+    orderCtx    *order = info->order;
+    FactoryInfo *owner = target != NULL ? target : info;
+    int won;
+
+    Sem_wait(&order->lock);
+    won = !owner->resolved;
+    if (won) {
+        owner->resolved = 1;
+        if (target != NULL) {
+            // Our parts stand in for the owner's
+            Sem_post(&target->cancel);
+            target->partsMade  -= parts;
+            target->iterations -= 1;
+            info->partsMade    += parts;
+            info->iterations   += 1;
+            info->hedgesWon    += 1;
+            info->savedMs      += target->dueMs - monoMs();
+        }
+        else if (info->hedgedBy != NULL)
+            Sem_post(&info->hedgedBy->cancel);
+    }
+    if (target == NULL)
+        info->inFlight = 0;
+    Sem_post(&order->lock);
+
+    // The winner posted our cancel before letting go of the lock
+    if (!won)
+        while (sem_trywait(&info->cancel) == 0)
+            ;
+    return won;
 }
 
 /* ======================================================================== */
@@ -280,63 +1362,264 @@ int main(int argc, char *argv[])
 
 void *subFactory(void *arg)
 {
-    FactoryInfo *info = (FactoryInfo *) arg;
+    FactoryInfo *info  = (FactoryInfo *) arg;
+    orderCtx    *order = info->order;
     char   strBuff[MAXSTR];
     msgBuf msg;
+    struct timespec claimAt, madeAt;
+    unsigned id = order->orderID;
+
+    traceThreadName("order %u sub-factory %d", id, info->factoryID);
 
     while (1) {
-        int toMake = 0;
+        uint64_t     toMake = 0;
+        FactoryInfo *target = NULL;    // the claim we race, if hedging
 
         /* --------- Decide how many parts to make this iteration -------- */
-        Sem_wait(mutex);
-
-        if (remainsToMake <= 0) {
-            // No more work left for anybody
-            Sem_post(mutex);
-            break;
+        uint64_t tr = traceNow();
+        Sem_wait(&order->lock);
+        traceSpan("sem wait", tr, id);
+        tr = traceNow();
+        clock_gettime(CLOCK_REALTIME, &claimAt);
+
+        if (order->remainsToMake == 0) {
+            // No more work left to claim. Rather than sit idle, race a
+            // slower sub-factory for its final claim
+            if (hedgeParts > 0)
+                target = pickHedge(info);
+            if (target == NULL) {
+                Sem_post(&order->lock);
+                break;
+            }
+
+            target->hedgedBy = info;
+            toMake = target->inFlight;
+            Sem_post(&order->lock);
+            traceSpan("hedge", tr, id);
+        }
+        else {
+            toMake = minimum(order->remainsToMake,
+                             info->capacity * order->claimUnits);
+            order->remainsToMake -= toMake;
+
+            info->partsMade  += toMake;
+            info->iterations += 1;
+
+            // From now on an idle sub-factory may race this claim
+            if (hedgeParts > 0) {
+                uint64_t units = (toMake + info->capacity - 1) / info->capacity;
+                info->inFlight = toMake;
+                info->dueMs    = monoMs() + units * info->duration;
+                info->hedgedBy = NULL;
+                info->resolved = 0;
+            }
+
+            Sem_post(&order->lock);
+            traceSpan("claim", tr, id);
         }
 
-        toMake = minimum(remainsToMake, info->capacity);
-        remainsToMake -= toMake;
-
-        info->partsMade  += toMake;
-        info->iterations += 1;
-
-        Sem_post(mutex);
+        // Over its parts rate: this client's work waits its turn, which
+        // counts as queueing rather than manufacturing
+        if (order->rl != NULL && target == NULL) {
+            double waitMs = rlTakeParts(order->rl, toMake);
+            if (waitMs > 0) {
+                tr = traceNow();
+                Msleep((uint64_t) waitMs);
+                rlThrottled(order->rl, waitMs);
+                clock_gettime(CLOCK_REALTIME, &claimAt);
+                traceSpan("throttle", tr, id);
+            }
+        }
 
         /* ------------- Simulate manufacturing time -------------------- */
-        Usleep((useconds_t) info->duration * 1000);
+        // One duration per capacity-unit actually used by this claim
+        uint64_t units   = (toMake + info->capacity - 1) / info->capacity;
+        uint64_t claimMs = units * info->duration;
+
+        tr = traceNow();
+        double startMs = monoMs();
+        makeFor(info, claimMs);
+        clock_gettime(CLOCK_REALTIME, &madeAt);
+        traceSpan(target != NULL ? "hedge manufacture" : "manufacture", tr, id);
+        double tookMs = monoMs() - startMs;
+        info->busyMs += tookMs;
+
+        // First to finish a raced claim reports it; the other was cancelled
+        if (hedgeParts > 0 && !settleRace(info, target, toMake)) {
+            info->hedgesLost += 1;
+            info->wastedMs   += tookMs;
+            clock_gettime(CLOCK_REALTIME, &info->readyAt);
+            continue;
+        }
 
         /* ------------------ Send PRODUCTION_MSG ----------------------- */
         memset(&msg, 0, sizeof(msg));
         msg.purpose  = htonl(PRODUCTION_MSG);
         msg.facID    = htonl(info->factoryID);
         msg.capacity = htonl(info->capacity);
-        msg.partsMade= htonl(toMake);
-        msg.duration = htonl(info->duration);
-
-        sendto(sd, &msg, sizeof(msg), 0,
-               (SA *) &clntSkt, sizeof(clntSkt));
+        setPartsMade(&msg, toMake);
+        msg.duration = htonl(claimMs > UINT32_MAX ? UINT32_MAX : (uint32_t) claimMs);
+        msg.units    = htonl(units > UINT32_MAX ? UINT32_MAX : (uint32_t) units);
+        msg.orderID  = htonl(order->orderID);
+        msg.queueUs  = htonl(usBetween(&info->readyAt, &claimAt));
+        msg.makeUs   = htonl(usBetween(&claimAt, &madeAt));
+
+        tr = traceNow();
+        if (asmOn) {
+            // Assembly/QA sends it once the batch passes; blocks while
+            // the stage is backed up
+            asmBatch b;
+            b.msg     = msg;
+            b.to      = &order->client;
+            b.done    = &info->assembled;
+            b.parts   = toMake;
+            b.claimAt = claimAt;
+            info->stallMs += asmSubmit(&b);
+            info->batchesQueued++;
+            traceSpan("enqueue", tr, id);
+        }
+        else {
+            // Reported parts are never made again after a restart
+            if (journalOn)
+                journalSync(journalLog(JR_CLAIM, &order->client, id,
+                                       info->factoryID, toMake));
+            stampSend(&msg);
+            ioSend(&msg, &order->client);
+            traceSpan("send", tr, id);
+        }
+        clock_gettime(CLOCK_REALTIME, &info->readyAt);
 
-        printf("Factory ( by AIDEN SMITH, BRADEN DRAKE )  # %2d: Going to make %5d parts in %4d mSec\n",
-               info->factoryID, toMake, info->duration);
+        printf("Factory ( by AIDEN SMITH, BRADEN DRAKE )  # %2d: Going to make %5" PRIu64 " parts in %4" PRIu64 " mSec\n",
+               info->factoryID, toMake, claimMs);
         fflush(stdout);
     }
 
+    // Not complete until the last of our batches has been reported
+    uint64_t tr = traceNow();
+    for (int i = 0; i < info->batchesQueued; i++)
+        Sem_wait(&info->assembled);
+    if (info->batchesQueued > 0)
+        traceSpan("await assembly", tr, id);
+
     /* ------------------ Send COMPLETION_MSG --------------------------- */
     msgBuf done;
     memset(&done, 0, sizeof(done));
     done.purpose = htonl(COMPLETION_MSG);
     done.facID   = htonl(info->factoryID);
+    done.orderID = htonl(order->orderID);
+    done.queueUs = htonl(usBetween(&info->readyAt, &claimAt));
 
-    sendto(sd, &done, sizeof(done), 0,
-           (SA *) &clntSkt, sizeof(clntSkt));
+    tr = traceNow();
+    if (journalOn)
+        journalSync(journalLog(JR_FACDONE, &order->client, id,
+                               info->factoryID, 0));
+    stampSend(&done);
+    ioSend(&done, &order->client);
+    traceSpan("send completion", tr, id);
 
     snprintf(strBuff, MAXSTR,
-             ">>> Factory # %-3d : Terminating after making total of %-5d"
+             ">>> Factory # %-3d : Terminating after making total of %-5" PRIu64
              " parts in %-4d iterations\n",
              info->factoryID, info->partsMade, info->iterations);
     factLog(strBuff);
 
+    traceThreadEnd();
+    return NULL;
+}
+
+/* ======================================================================== */
+/*                      Hot-restart hand-off thread routine                 */
+/* ======================================================================== */
+
+/* ------------------------------------------------------------------------
+   The session of every order still in progress: ours, and those we
+   inherited from a generation still draining. Caller holds mutex
+   ------------------------------------------------------------------------ */
+int handedOffSessions(handoffSession *hs)
+{
+    static session *act[HANDOFF_MAXSESS];
+    int n = sessionActive(act, HANDOFF_MAXSESS);
+
+    for (int i = 0; i < n; i++) {
+        memset(&hs[i], 0, sizeof(hs[i]));
+        hs[i].ip        = act[i]->ip;
+        hs[i].port      = act[i]->port;
+        hs[i].orderID   = act[i]->orderID;
+        hs[i].numFac    = act[i]->numFac;
+        hs[i].orderSize = act[i]->orderSize;
+        hs[i].fromStock = act[i]->fromStock;
+    }
+    return n;
+}
+
+void *handoffListener(void *arg)
+{
+    handoffState st;
+    int cfd;
+    (void) arg;
+
+    while (1) {
+        cfd = handoffAccept(handoffFd);
+
+        memset(&st, 0, sizeof(st));
+        st.magic      = HANDOFF_MAGIC;
+        st.version    = HANDOFF_VERSION;
+        st.port       = ntohs(srvrSkt.sin_port);
+        st.numFac     = numFac;
+        st.generation = generation;
+
+        // Snapshot the orders in progress with their sessions, and admit
+        // no new order until the replacement has acknowledged them
+        Sem_wait(mutex);
+        handingOff      = 1;
+        st.nSessions    = handedOffSessions(handedOff);
+        st.ordersServed = ordersServed;
+        st.ordersActive = activeOrders;
+        for (int i = 0; i < MAXORDERS; i++) {
+            orderCtx *ctx = slabAt(&orderPool, i);
+            if (!ctx->inUse)
+                continue;
+            Sem_wait(&ctx->lock);
+            st.partsPending += ctx->remainsToMake;
+            Sem_post(&ctx->lock);
+        }
+        Sem_post(mutex);
+
+        // Unsold stock goes with the socket
+        if (stockOn)
+            st.stock = stockFreeze();
+
+        if (handoffSend(cfd, sd, &st, handedOff) == 0)
+            break;
+
+        // The replacement died or rejected the state: carry on serving
+        // and wait for the next one
+        close(cfd);
+        Sem_wait(mutex);
+        handingOff = 0;
+        Sem_post(mutex);
+        if (stockOn)
+            stockThaw(st.stock);
+        handoffFd = handoffListen(st.port);
+
+        fprintf(stderr, "Hand-off to a replacement failed; still serving\n");
+    }
+
+    // cfd stays open until we exit: its end-of-file tells the
+    // replacement to take over our journal
+
+    Sem_wait(mutex);
+    st.ordersActive = activeOrders;
+    draining = 1;
+    Sem_post(mutex);
+
+    printf("\n### Socket handed off to a replacement factory; draining %d"
+           " order(s) in progress\n", st.ordersActive);
+    fflush(stdout);
+
+    // Wake main if it is waiting for requests
+    if (write(wakeFd[1], "x", 1) < 0)
+        perror("Error waking main thread");
+
     return NULL;
 }
@@ -0,0 +1,214 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : handoff.c
+//
+// Hot-restart support: a running factory hands its bound UDP socket
+// (via SCM_RIGHTS), a snapshot of its state and the sessions of the
+// orders it is still draining to a replacement process over a
+// Unix-domain stream socket in the abstract namespace. Only a
+// process of the same user may connect, and the old factory lets go
+// only once the replacement has acknowledged the state.
+//---------------------------------------------------------------------
+
+#define _GNU_SOURCE             /* struct ucred */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
+
+#include "wrappers.h"
+#include "handoff.h"
+
+typedef struct sockaddr SA;
+
+/*--------------------------------------------------------------------
+   Build the abstract address "\0Team25_factory.<port>"
+----------------------------------------------------------------------*/
+static socklen_t handoffAddr( unsigned short port , struct sockaddr_un *un )
+{
+    memset( un , 0 , sizeof( *un ) ) ;
+    un->sun_family = AF_UNIX ;
+    int len = snprintf( un->sun_path + 1 , sizeof( un->sun_path ) - 1 ,
+                        "Team25_factory.%u" , port ) ;
+
+    return (socklen_t) ( offsetof( struct sockaddr_un , sun_path ) + 1 + len ) ;
+}
+
+/*--------------------------------------------------------------------
+   Listen for a replacement process. Returns the listening descriptor
+----------------------------------------------------------------------*/
+int handoffListen( unsigned short port )
+{
+    struct sockaddr_un un ;
+    socklen_t len = handoffAddr( port , &un ) ;
+
+    int lfd = socket( AF_UNIX , SOCK_STREAM , 0 ) ;
+    if ( lfd < 0 )
+        err_sys( "Could not create hand-off socket" ) ;
+
+    if ( bind( lfd , (SA *) &un , len ) < 0 )
+        err_sys( "Could not bind hand-off socket (is another factory on this port?)" ) ;
+
+    if ( listen( lfd , 1 ) < 0 )
+        err_sys( "Could not listen on hand-off socket" ) ;
+
+    return lfd ;
+}
+
+/*--------------------------------------------------------------------
+   Is the process at the other end of 'fd' run by our user?
+----------------------------------------------------------------------*/
+static int sameUser( int fd )
+{
+    struct ucred cr ;
+    socklen_t    len = sizeof( cr ) ;
+
+    if ( getsockopt( fd , SOL_SOCKET , SO_PEERCRED , &cr , &len ) < 0 )
+        return 0 ;
+    return cr.uid == geteuid() ;
+}
+
+/*--------------------------------------------------------------------
+   Wait for one replacement run by our user, then release the abstract
+   name so the replacement can listen on it in turn. Anybody else is
+   turned away
+----------------------------------------------------------------------*/
+int handoffAccept( int lfd )
+{
+    int cfd ;
+
+    while ( 1 )
+    {
+        if ( ( cfd = accept( lfd , NULL , NULL ) ) < 0 )
+        {
+            if ( errno != EINTR )
+                err_sys( "Error during hand-off accept()" ) ;
+            continue ;
+        }
+
+        if ( sameUser( cfd ) )
+            break ;
+
+        fprintf( stderr , "Hand-off refused: peer is not our user\n" ) ;
+        close( cfd ) ;
+    }
+
+    close( lfd ) ;
+    return cfd ;
+}
+
+/*--------------------------------------------------------------------
+   Send the state snapshot with the UDP descriptor attached, followed by
+   its st->nSessions sessions, and wait for the replacement to take it.
+   Returns 0 once acknowledged, -1 if the replacement went away or
+   rejected the state
+----------------------------------------------------------------------*/
+int handoffSend( int cfd , int sd , handoffState *st , handoffSession *sess )
+{
+    struct iovec  iov[ 2 ] = { { .iov_base = st   , .iov_len = sizeof( *st ) } ,
+                               { .iov_base = sess , .iov_len = st->nSessions * sizeof( *sess ) } } ;
+    size_t        total    = iov[ 0 ].iov_len + iov[ 1 ].iov_len ;
+    char          ctl[ CMSG_SPACE( sizeof( int ) ) ] ;
+    struct msghdr mh ;
+
+    memset( &mh , 0 , sizeof( mh ) ) ;
+    memset( ctl , 0 , sizeof( ctl ) ) ;
+    mh.msg_iov        = iov ;
+    mh.msg_iovlen     = 2 ;
+    mh.msg_control    = ctl ;
+    mh.msg_controllen = sizeof( ctl ) ;
+
+    struct cmsghdr *cm = CMSG_FIRSTHDR( &mh ) ;
+    cm->cmsg_level = SOL_SOCKET ;
+    cm->cmsg_type  = SCM_RIGHTS ;
+    cm->cmsg_len   = CMSG_LEN( sizeof( int ) ) ;
+    memcpy( CMSG_DATA( cm ) , &sd , sizeof( int ) ) ;
+
+    if ( sendmsg( cfd , &mh , MSG_NOSIGNAL ) != (ssize_t) total )
+    {
+        perror( "Error sending hand-off state" ) ;
+        return -1 ;
+    }
+
+    struct timeval wait = { HANDOFF_ACK_SEC , 0 } ;
+    unsigned       ack  = 0 ;
+    setsockopt( cfd , SOL_SOCKET , SO_RCVTIMEO , &wait , sizeof( wait ) ) ;
+
+    if ( recv( cfd , &ack , sizeof( ack ) , MSG_WAITALL ) != (ssize_t) sizeof( ack )
+         || ack != HANDOFF_ACK )
+        return -1 ;
+
+    return 0 ;
+}
+
+/*--------------------------------------------------------------------
+   Connect to the running factory on 'port' and take over its socket.
+   Returns the received UDP descriptor and fills in 'st'; '*sess' is an
+   allocated array of st->nSessions sessions, which the caller frees.
+   '*link' stays connected to the old factory for as long as it lives
+----------------------------------------------------------------------*/
+int handoffReceive( unsigned short port , handoffState *st ,
+                    handoffSession **sess , int *link )
+{
+    struct sockaddr_un un ;
+    socklen_t len = handoffAddr( port , &un ) ;
+
+    int cfd = socket( AF_UNIX , SOCK_STREAM , 0 ) ;
+    if ( cfd < 0 )
+        err_sys( "Could not create hand-off socket" ) ;
+
+    if ( connect( cfd , (SA *) &un , len ) < 0 )
+        err_sys( "No running factory to take over from" ) ;
+
+    if ( !sameUser( cfd ) )
+        err_quit( "The factory on this port belongs to another user\n" ) ;
+
+    struct iovec  iov  = { .iov_base = st , .iov_len = sizeof( *st ) } ;
+    char          ctl[ CMSG_SPACE( sizeof( int ) ) ] ;
+    struct msghdr mh ;
+
+    memset( &mh , 0 , sizeof( mh ) ) ;
+    mh.msg_iov        = &iov ;
+    mh.msg_iovlen     = 1 ;
+    mh.msg_control    = ctl ;
+    mh.msg_controllen = sizeof( ctl ) ;
+
+    if ( recvmsg( cfd , &mh , MSG_WAITALL ) != (ssize_t) sizeof( *st ) )
+        err_sys( "Error receiving hand-off state" ) ;
+
+    // Without our ack the old factory keeps serving, so bailing out
+    // here leaves the port in good hands
+    struct cmsghdr *cm = CMSG_FIRSTHDR( &mh ) ;
+    if ( cm == NULL || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS )
+        err_quit( "Hand-off did not carry a socket descriptor\n" ) ;
+
+    int sd ;
+    memcpy( &sd , CMSG_DATA( cm ) , sizeof( int ) ) ;
+
+    if ( st->magic != HANDOFF_MAGIC || st->version != HANDOFF_VERSION
+         || st->nSessions < 0 || st->nSessions > HANDOFF_MAXSESS )
+    {
+        close( sd ) ;
+        err_quit( "Hand-off state has an unknown format; old factory keeps the port\n" ) ;
+    }
+
+    size_t bytes = st->nSessions * sizeof( **sess ) ;
+    *sess = malloc( bytes + 1 ) ;
+    if ( *sess == NULL )
+        err_sys( "Could not allocate the handed-off sessions" ) ;
+
+    if ( bytes > 0 && recv( cfd , *sess , bytes , MSG_WAITALL ) != (ssize_t) bytes )
+        err_sys( "Error receiving hand-off sessions" ) ;
+
+    unsigned ack = HANDOFF_ACK ;
+    if ( send( cfd , &ack , sizeof( ack ) , MSG_NOSIGNAL ) != (ssize_t) sizeof( ack ) )
+        err_sys( "Error acknowledging the hand-off" ) ;
+
+    // The old factory holds its end until it exits, so '*link' reads
+    // end-of-file once it is gone, however it went
+    *link = cfd ;
+    return sd ;
+}
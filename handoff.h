@@ -0,0 +1,55 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : handoff.h
+//---------------------------------------------------------------------
+
+#ifndef  HANDOFF_H
+#define  HANDOFF_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#define HANDOFF_MAGIC    0x54323548   /* "T25H" */
+#define HANDOFF_VERSION  6
+#define HANDOFF_ACK      0x5432354b   /* "T25K": replacement took over  */
+#define HANDOFF_ACK_SEC  5            /* give up on a silent replacement */
+#define HANDOFF_MAXSESS  4096         /* active sessions a hand-off carries */
+
+/* ------- State passed from the old factory to its replacement ---------- */
+typedef struct {
+    unsigned  magic ,          /* HANDOFF_MAGIC                          */
+              version ;        /* HANDOFF_VERSION                        */
+    unsigned short port ;      /* UDP port the handed-off socket is bound */
+    int       numFac ;         /* sub-factories per order in old process */
+    int       generation ;     /* how many hand-offs preceded this one    */
+    long      ordersServed ;   /* orders completed by all generations     */
+
+    /* Snapshot of the orders the old process is still draining */
+    int       ordersActive ;
+    uint64_t  partsPending ;   /* parts not yet claimed across them       */
+
+    uint64_t  stock ;          /* make-to-stock parts now owned by the new */
+    int       nSessions ;      /* handoffSession records that follow      */
+} handoffState ;
+
+/* ------- An order the old factory is still draining: a retransmitted -----
+   ------- REQUEST_MSG for it is confirmed, not manufactured again ------- */
+typedef struct {
+    uint32_t  ip ;             /* client address, network order          */
+    uint16_t  port ;
+    unsigned  orderID ;
+    int       numFac ;
+    uint64_t  orderSize ,
+              fromStock ;
+} handoffSession ;
+
+int   handoffListen( unsigned short port ) ;
+int   handoffAccept( int lfd ) ;
+int   handoffSend( int cfd , int sd , handoffState *st ,
+                   handoffSession *sess ) ;                   /* 0 = acked */
+int   handoffReceive( unsigned short port , handoffState *st ,
+                      handoffSession **sess , int *link ) ;
+
+#endif
@@ -0,0 +1,836 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : ioengine.c
+//
+// Socket I/O for the factory, either with plain recvfrom()/sendto()
+// (IO_CLASSIC) or through an io_uring owned by one engine thread
+// (IO_URING). The io_uring engine keeps a multishot RECVMSG armed over
+// a provided-buffer ring and hands received datagrams to main. Senders
+// copy their msgBuf into a registered send slot and queue the SEND on
+// the ring themselves. While sends come more often than every FLUSH_NS
+// the engine wakes up every FLUSH_NS and one io_uring_enter() submits
+// all of them. A send that finds the engine idle is submitted by its
+// sender, which costs what a sendto() does; if it follows two others
+// closely, its completion wakes the engine to batch what comes next.
+// Sends carry MSG_DONTWAIT, so the kernel copies the payload while
+// submitting and the slot is free again once its SQE is consumed; other
+// successful sends post no CQE at all.
+// Raw syscalls are used; no liburing needed.
+//---------------------------------------------------------------------
+
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+#include "wrappers.h"
+#include "ioengine.h"
+
+#define RING_ENTRIES    256         /* SQ size; CQ is four times this   */
+#define NSLOTS          256         /* registered send slots            */
+#define NRBUFS          256         /* provided receive buffers (2^k)   */
+#define RBUF_SIZE       128         /* header + name + one msgBuf       */
+#define RQ_SIZE         1024        /* datagrams queued for main        */
+#define BGID            1           /* provided-buffer group id         */
+#define FLUSH_NS        5000000     /* longest a queued send waits      */
+#define FLUSH_BATCH     32          /* ... or until this many are queued */
+
+#define TAG_RECV        1ULL
+#define TAG_SEND        2ULL
+#define TAG_KICK        3ULL
+#define TAG_CANCEL      4ULL
+#define UDATA( tag , idx )  ( ( (tag) << 32 ) | (unsigned) (idx) )
+
+typedef struct sockaddr SA;
+
+static int        engine = IO_CLASSIC ;
+static int        sock ;
+static ioStats    stats ;
+static volatile int recvStopped = 0 ;
+
+#define COUNT( field , n )  __atomic_add_fetch( &stats.field , (n) , __ATOMIC_RELAXED )
+
+/*--------------------------------------------------------------------
+   Count a failed send; the first one of a run is worth a message
+----------------------------------------------------------------------*/
+static void sendFailed( int err )
+{
+    if ( COUNT( sendErrors , 1 ) == 1 )
+        fprintf( stderr , "Socket I/O: send failed (%s); counting further failures\n" ,
+                 strerror( err ) ) ;
+}
+
+/* ------------------------------- The ring ------------------------------ */
+static int        ringFd ;
+static unsigned  *sqHead , *sqTail , *sqMask , *sqArray , sqEntries ;
+static unsigned  *cqHead , *cqTail , *cqMask ;
+static struct io_uring_sqe *sqes ;
+static struct io_uring_cqe *cqes ;
+static unsigned   sqLocalTail ;
+static unsigned   sqRetired ;        /* SQEs before this gave back their slot */
+static int        sqeSlot[ RING_ENTRIES ] ;   /* send slot of each SQE, or -1 */
+
+/* -------------------------- Registered send slots ---------------------- */
+typedef struct {
+    msgBuf              msg ;
+    struct sockaddr_in  to ;
+} sendSlot ;
+
+static sendSlot   slots[ NSLOTS ] ;
+static int        freeSlots[ NSLOTS ] , freeTop ;
+static sem_t      slotSem ;          /* counts free slots              */
+static int        fixedSends = 1 ;   /* cleared if the kernel refuses  */
+
+/* -------------------------- Provided receive buffers ------------------- */
+static struct io_uring_buf_ring *bufRing ;
+static char       recvBufs[ NRBUFS ][ RBUF_SIZE ] ;
+static struct msghdr recvTmpl ;      /* only name/control sizes used   */
+
+/* --------------------------- Datagrams for main ------------------------ */
+typedef struct {
+    msgBuf              msg ;
+    struct sockaddr_in  from ;
+} rqEntry ;
+
+static rqEntry    rq[ RQ_SIZE ] ;
+static int        rqHead , rqCount ;
+static int        readyFd ;          /* raised for main once it sleeps  */
+static int        readyRaised ;      /* readyFd holds a count          */
+static int        mainAsleep ;       /* main is about to poll() readyFd */
+
+/* ------------------------- Engine thread control ----------------------- */
+enum { ENGINE_BUSY , ENGINE_BATCHING , ENGINE_IDLE } ;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER ;   /* SQ and all below */
+static int        engineState = ENGINE_BUSY ;
+static int        sendsSeen ;        /* queued since the engine last looked */
+static double     sendMs[ 2 ] ;      /* when the last two sends came   */
+static int        kickFd ;           /* wakes the engine to stop receiving */
+static uint64_t   kickVal ;
+static int        stopRequested , stopReported ;
+static sem_t      stopDone ;
+
+//------------------
+
+static int uringSetup( unsigned entries , struct io_uring_params *p )
+{
+    return (int) syscall( __NR_io_uring_setup , entries , p ) ;
+}
+
+static int uringEnter( unsigned toSubmit , unsigned minComplete , unsigned flags )
+{
+    COUNT( syscalls , 1 ) ;
+    return (int) syscall( __NR_io_uring_enter , ringFd , toSubmit , minComplete , flags , NULL , 0 ) ;
+}
+
+/*--------------------------------------------------------------------
+   Submit 'toSubmit' SQEs and wait for one CQE, or at most 'ns'
+   nanoseconds if that is not 0. A timeout fails with ETIME. The kernel
+   skips the wait if it found fewer SQEs than 'toSubmit'
+----------------------------------------------------------------------*/
+static int uringWait( unsigned toSubmit , long ns )
+{
+    struct __kernel_timespec      ts = { .tv_sec = 0 , .tv_nsec = ns } ;
+    struct io_uring_getevents_arg ga ;
+
+    if ( ns == 0 )
+        return uringEnter( toSubmit , 1 , IORING_ENTER_GETEVENTS ) ;
+
+    memset( &ga , 0 , sizeof( ga ) ) ;
+    ga.ts = (uint64_t) (uintptr_t) &ts ;
+    COUNT( syscalls , 1 ) ;
+    return (int) syscall( __NR_io_uring_enter , ringFd , toSubmit , 1 ,
+                          IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG , &ga , sizeof( ga ) ) ;
+}
+
+static int uringRegister( unsigned op , void *arg , unsigned nr )
+{
+    return (int) syscall( __NR_io_uring_register , ringFd , op , arg , nr ) ;
+}
+
+/*--------------------------------------------------------------------
+   The kernel has consumed every SQE before *sqHead, and a MSG_DONTWAIT
+   send is finished with its payload by then: free their send slots.
+   Caller holds lock
+----------------------------------------------------------------------*/
+static void retireSubmitted( void )
+{
+    unsigned head = __atomic_load_n( sqHead , __ATOMIC_ACQUIRE ) ;
+
+    for ( ; sqRetired != head ; sqRetired++ )
+    {
+        int *slot = &sqeSlot[ sqRetired & *sqMask ] ;
+        if ( *slot >= 0 )
+        {
+            freeSlots[ freeTop++ ] = *slot ;
+            *slot = -1 ;
+            Sem_post( &slotSem ) ;
+        }
+    }
+}
+
+/*--------------------------------------------------------------------
+   Publish the SQEs queued so far; returns how many the kernel has yet
+   to consume. Caller holds lock
+----------------------------------------------------------------------*/
+static unsigned publishQueued( void )
+{
+    __atomic_store_n( sqTail , sqLocalTail , __ATOMIC_RELEASE ) ;
+    return sqLocalTail - __atomic_load_n( sqHead , __ATOMIC_ACQUIRE ) ;
+}
+
+/*--------------------------------------------------------------------
+   Hand everything queued to the kernel without waiting. Caller holds lock
+----------------------------------------------------------------------*/
+static void submitQueued( void )
+{
+    uringEnter( publishQueued() , 0 , 0 ) ;
+    retireSubmitted() ;
+}
+
+/*--------------------------------------------------------------------
+   Next free SQE, flushing the SQ to the kernel if it is full.
+   Caller holds lock (or is alone with the ring)
+----------------------------------------------------------------------*/
+static struct io_uring_sqe *getSqe( void )
+{
+    retireSubmitted() ;
+
+    if ( sqLocalTail - sqRetired == sqEntries )
+    {
+        submitQueued() ;
+        if ( sqLocalTail - sqRetired == sqEntries )
+            return NULL ;
+    }
+
+    unsigned idx = sqLocalTail & *sqMask ;
+    struct io_uring_sqe *sqe = &sqes[ idx ] ;
+
+    memset( sqe , 0 , sizeof( *sqe ) ) ;
+    sqArray[ idx ] = idx ;
+    sqeSlot[ idx ] = -1 ;
+    sqLocalTail++ ;
+    return sqe ;
+}
+
+//------------------
+
+static void recycleBuf( int bid )
+{
+    unsigned short tail = bufRing->tail ;
+    struct io_uring_buf *b = &bufRing->bufs[ tail & ( NRBUFS - 1 ) ] ;
+
+    b->addr = (uint64_t) (uintptr_t) recvBufs[ bid ] ;
+    b->len  = RBUF_SIZE ;
+    b->bid  = (unsigned short) bid ;
+    __atomic_store_n( &bufRing->tail , (unsigned short) ( tail + 1 ) , __ATOMIC_RELEASE ) ;
+}
+
+//------------------
+
+static int armRecv( void )
+{
+    struct io_uring_sqe *sqe = getSqe() ;
+    if ( sqe == NULL )
+        return 0 ;
+
+    sqe->opcode    = IORING_OP_RECVMSG ;
+    sqe->fd        = sock ;
+    sqe->addr      = (uint64_t) (uintptr_t) &recvTmpl ;
+    sqe->flags     = IOSQE_BUFFER_SELECT ;
+    sqe->buf_group = BGID ;
+    sqe->ioprio    = IORING_RECV_MULTISHOT ;
+    sqe->user_data = UDATA( TAG_RECV , 0 ) ;
+    return 1 ;
+}
+
+//------------------
+
+static int armKick( void )
+{
+    struct io_uring_sqe *sqe = getSqe() ;
+    if ( sqe == NULL )
+        return 0 ;
+
+    sqe->opcode    = IORING_OP_READ ;
+    sqe->fd        = kickFd ;
+    sqe->addr      = (uint64_t) (uintptr_t) &kickVal ;
+    sqe->len       = sizeof( kickVal ) ;
+    sqe->user_data = UDATA( TAG_KICK , 0 ) ;
+    return 1 ;
+}
+
+//------------------
+
+static int prepSend( int slot , int wake )
+{
+    struct io_uring_sqe *sqe = getSqe() ;
+    if ( sqe == NULL )
+        return 0 ;
+
+    sqe->opcode    = IORING_OP_SEND ;
+    sqe->fd        = sock ;
+    sqe->addr      = (uint64_t) (uintptr_t) &slots[ slot ].msg ;
+    sqe->len       = sizeof( msgBuf ) ;
+    sqe->addr2     = (uint64_t) (uintptr_t) &slots[ slot ].to ;
+    sqe->addr_len  = sizeof( struct sockaddr_in ) ;
+    sqe->msg_flags = MSG_DONTWAIT ;             // done by the time it is consumed
+    if ( !wake )
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS ;   // only failures are reported
+    sqe->user_data = UDATA( TAG_SEND , slot ) ;
+    if ( fixedSends )
+    {
+        sqe->ioprio    = IORING_RECVSEND_FIXED_BUF ;
+        sqe->buf_index = 0 ;
+    }
+    sqeSlot[ ( sqLocalTail - 1 ) & *sqMask ] = slot ;
+    return 1 ;
+}
+
+//------------------
+
+static int prepCancelRecv( void )
+{
+    struct io_uring_sqe *sqe = getSqe() ;
+    if ( sqe == NULL )
+        return 0 ;
+
+    sqe->opcode    = IORING_OP_ASYNC_CANCEL ;
+    sqe->addr      = UDATA( TAG_RECV , 0 ) ;
+    sqe->user_data = UDATA( TAG_CANCEL , 0 ) ;
+    return 1 ;
+}
+
+/*--------------------------------------------------------------------
+   Queue a received datagram for main
+----------------------------------------------------------------------*/
+static void deliver( char *buf , int len )
+{
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *) buf ;
+    char   *name    = buf + sizeof( *out ) ;
+    char   *payload = name + recvTmpl.msg_namelen + recvTmpl.msg_controllen ;
+    size_t  n       = out->payloadlen ;
+    size_t  room    = ( buf + len ) - payload ;
+
+    if ( n > room )
+        n = room ;
+    if ( n > sizeof( msgBuf ) )
+        n = sizeof( msgBuf ) ;
+
+    COUNT( datagramsIn , 1 ) ;
+
+    pthread_mutex_lock( &lock ) ;
+    if ( rqCount == RQ_SIZE )
+    {
+        pthread_mutex_unlock( &lock ) ;
+        COUNT( drops , 1 ) ;
+        return ;
+    }
+
+    rqEntry *e = &rq[ ( rqHead + rqCount ) % RQ_SIZE ] ;
+    memset( e , 0 , sizeof( *e ) ) ;
+    memcpy( &e->msg , payload , n ) ;
+    memcpy( &e->from , name , sizeof( e->from ) ) ;
+    __atomic_fetch_add( &rqCount , 1 , __ATOMIC_RELEASE ) ;
+
+    // Main picks this up by itself unless it said it is going to sleep.
+    // Raised under the lock so ioArmWait() never resets a stale count
+    if ( mainAsleep && !readyRaised )
+    {
+        uint64_t one = 1 ;
+        COUNT( syscalls , 1 ) ;
+        if ( write( readyFd , &one , sizeof( one ) ) < 0 )
+            perror( "io_uring engine: write(readyFd)" ) ;
+        readyRaised = 1 ;
+    }
+    mainAsleep = 0 ;
+    pthread_mutex_unlock( &lock ) ;
+}
+
+/*--------------------------------------------------------------------
+   The only thread that touches the ring
+----------------------------------------------------------------------*/
+static void *uringEngine( void *arg )
+{
+    int recvArmed = 0 , kickArmed = 0 , cancelSent = 0 ;
+
+    while ( 1 )
+    {
+        /* ------------- Arm what is missing, choose how to wait --------- */
+        pthread_mutex_lock( &lock ) ;
+        int stopping = stopRequested ;
+
+        if ( !recvArmed && !stopping )
+            recvArmed = armRecv() ;
+
+        if ( stopping && recvArmed && !cancelSent )
+            cancelSent = prepCancelRecv() ;
+
+        if ( stopping && !recvArmed && !stopReported )
+        {
+            stopReported = 1 ;
+            recvStopped  = 1 ;
+            Sem_post( &stopDone ) ;
+        }
+
+        if ( !kickArmed )
+            kickArmed = armKick() ;
+
+        // A send woke us, or the last wait caught some: come back
+        // shortly and submit the next ones together. Otherwise sleep
+        // until a datagram arrives and let senders submit their own
+        engineState = sendsSeen > 0 ? ENGINE_BATCHING : ENGINE_IDLE ;
+        sendsSeen   = 0 ;
+        long     waitNs   = engineState == ENGINE_BATCHING ? FLUSH_NS : 0 ;
+        unsigned toSubmit = publishQueued() ;
+        pthread_mutex_unlock( &lock ) ;
+
+        /* -------- Submit everything, wait for one CQE or the timeout --- */
+        if ( uringWait( toSubmit , waitNs ) < 0 && errno != EINTR && errno != EAGAIN
+             && errno != EBUSY && errno != ETIME )
+            err_sys( "io_uring_enter() failed" ) ;
+
+        pthread_mutex_lock( &lock ) ;
+        engineState = ENGINE_BUSY ;
+        retireSubmitted() ;
+        pthread_mutex_unlock( &lock ) ;
+
+        /* ------------------------- Reap completions -------------------- */
+        unsigned head = *cqHead ;
+        unsigned tail = __atomic_load_n( cqTail , __ATOMIC_ACQUIRE ) ;
+
+        for ( ; head != tail ; head++ )
+        {
+            struct io_uring_cqe *cqe = &cqes[ head & *cqMask ] ;
+            unsigned tag  = (unsigned) ( cqe->user_data >> 32 ) ;
+
+            switch ( tag )
+            {
+                case TAG_RECV :
+                    if ( cqe->res >= 0 && ( cqe->flags & IORING_CQE_F_BUFFER ) )
+                    {
+                        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT ;
+                        deliver( recvBufs[ bid ] , RBUF_SIZE ) ;
+                        recycleBuf( bid ) ;
+                    }
+                    if ( !( cqe->flags & IORING_CQE_F_MORE ) )
+                        recvArmed = 0 ;      // re-armed next time around
+                    break ;
+
+                case TAG_KICK :
+                    kickArmed = 0 ;
+                    break ;
+
+                case TAG_SEND :
+                    // A failure, or a send sent to wake us; the slot was
+                    // freed on submit
+                    if ( cqe->res < 0 )
+                    {
+                        __atomic_sub_fetch( &stats.datagramsOut , 1 , __ATOMIC_RELAXED ) ;
+                        sendFailed( -cqe->res ) ;
+                    }
+                    break ;
+
+                default :
+                    break ;
+            }
+        }
+        __atomic_store_n( cqHead , head , __ATOMIC_RELEASE ) ;
+    }
+
+    return NULL ;
+}
+
+/*--------------------------------------------------------------------
+   Send the byte at the start of slot 0 to 'to' the way prepSend()
+   does, but asking for the result. Returns the CQE's res
+----------------------------------------------------------------------*/
+static int probeSend( int fd , struct sockaddr_in *to )
+{
+    struct io_uring_sqe *sqe = getSqe() ;
+    int res = -EIO ;
+
+    sqe->opcode    = IORING_OP_SEND ;
+    sqe->fd        = fd ;
+    sqe->addr      = (uint64_t) (uintptr_t) &slots[ 0 ].msg ;
+    sqe->len       = 1 ;
+    sqe->addr2     = (uint64_t) (uintptr_t) to ;
+    sqe->addr_len  = sizeof( *to ) ;
+    sqe->msg_flags = MSG_DONTWAIT ;
+    sqe->user_data = UDATA( TAG_SEND , 0 ) ;
+    if ( fixedSends )
+    {
+        sqe->ioprio    = IORING_RECVSEND_FIXED_BUF ;
+        sqe->buf_index = 0 ;
+    }
+
+    int entered = uringEnter( publishQueued() , 1 , IORING_ENTER_GETEVENTS ) ;
+    retireSubmitted() ;
+
+    unsigned head = *cqHead ;
+    if ( entered >= 0 && head != __atomic_load_n( cqTail , __ATOMIC_ACQUIRE ) )
+    {
+        res = cqes[ head & *cqMask ].res ;
+        __atomic_store_n( cqHead , head + 1 , __ATOMIC_RELEASE ) ;
+    }
+    return res ;
+}
+
+/*--------------------------------------------------------------------
+   Does IORING_OP_SEND honour a destination address (addr2) here?
+   Kernels before 6.0 ignore it, and every send from our unconnected
+   socket would fail. Also finds out whether sends may come from the
+   registered slots. Sends one byte to a throwaway socket to find out.
+   Runs before the engine thread owns the ring
+----------------------------------------------------------------------*/
+static int probeSendTo( void )
+{
+    struct sockaddr_in  to ;
+    socklen_t           alen = sizeof( to ) ;
+    char                got = 0 ;
+    int                 ok = 0 ;
+
+    int rx = socket( AF_INET , SOCK_DGRAM , 0 ) ;
+    int tx = socket( AF_INET , SOCK_DGRAM , 0 ) ;
+
+    memset( &to , 0 , sizeof( to ) ) ;
+    to.sin_family      = AF_INET ;
+    to.sin_addr.s_addr = htonl( INADDR_LOOPBACK ) ;
+    *(char *) &slots[ 0 ].msg = 'p' ;
+
+    if ( rx >= 0 && tx >= 0
+         && bind( rx , (SA *) &to , sizeof( to ) ) == 0
+         && getsockname( rx , (SA *) &to , &alen ) == 0 )
+    {
+        int res = probeSend( tx , &to ) ;
+        if ( res == -EINVAL && fixedSends )
+        {
+            // Kernel cannot send from registered buffers; send plainly
+            fixedSends = 0 ;
+            res = probeSend( tx , &to ) ;
+        }
+
+        ok = ( res == 1 && recv( rx , &got , 1 , MSG_DONTWAIT ) == 1 && got == 'p' ) ;
+    }
+
+    if ( rx >= 0 )
+        close( rx ) ;
+    if ( tx >= 0 )
+        close( tx ) ;
+    return ok ;
+}
+
+/*--------------------------------------------------------------------
+   Create the ring, register buffers and start the engine thread.
+   Returns 0 if io_uring is not usable here
+----------------------------------------------------------------------*/
+static int uringInit( void )
+{
+    struct io_uring_params p ;
+
+    memset( &p , 0 , sizeof( p ) ) ;
+    p.flags      = IORING_SETUP_CQSIZE ;
+    p.cq_entries = 4 * RING_ENTRIES ;
+
+    ringFd = uringSetup( RING_ENTRIES , &p ) ;
+    if ( ringFd < 0 )
+        return 0 ;
+
+    /* ------------------------ Map SQ, CQ and SQEs ---------------------- */
+    size_t sqSize = p.sq_off.array + p.sq_entries * sizeof( unsigned ) ;
+    size_t cqSize = p.cq_off.cqes  + p.cq_entries * sizeof( struct io_uring_cqe ) ;
+    if ( ( p.features & IORING_FEAT_SINGLE_MMAP ) && cqSize > sqSize )
+        sqSize = cqSize ;
+
+    char *sq = mmap( NULL , sqSize , PROT_READ | PROT_WRITE , MAP_SHARED | MAP_POPULATE ,
+                     ringFd , IORING_OFF_SQ_RING ) ;
+    char *cq = sq ;
+    if ( !( p.features & IORING_FEAT_SINGLE_MMAP ) )
+        cq = mmap( NULL , cqSize , PROT_READ | PROT_WRITE , MAP_SHARED | MAP_POPULATE ,
+                   ringFd , IORING_OFF_CQ_RING ) ;
+    sqes = mmap( NULL , p.sq_entries * sizeof( struct io_uring_sqe ) ,
+                 PROT_READ | PROT_WRITE , MAP_SHARED | MAP_POPULATE , ringFd , IORING_OFF_SQES ) ;
+    if ( sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED )
+    {
+        close( ringFd ) ;
+        return 0 ;
+    }
+
+    sqHead    = (unsigned *) ( sq + p.sq_off.head ) ;
+    sqTail    = (unsigned *) ( sq + p.sq_off.tail ) ;
+    sqMask    = (unsigned *) ( sq + p.sq_off.ring_mask ) ;
+    sqArray   = (unsigned *) ( sq + p.sq_off.array ) ;
+    sqEntries = p.sq_entries ;
+    cqHead    = (unsigned *) ( cq + p.cq_off.head ) ;
+    cqTail    = (unsigned *) ( cq + p.cq_off.tail ) ;
+    cqMask    = (unsigned *) ( cq + p.cq_off.ring_mask ) ;
+    cqes      = (struct io_uring_cqe *) ( cq + p.cq_off.cqes ) ;
+    sqLocalTail = sqRetired = *sqTail ;
+
+    /* ----------------- Register the send slots as one buffer ----------- */
+    struct iovec iov = { .iov_base = slots , .iov_len = sizeof( slots ) } ;
+    if ( uringRegister( IORING_REGISTER_BUFFERS , &iov , 1 ) < 0 )
+        fixedSends = 0 ;
+
+    // Batched sends need timed waits and CQE-less successful sends
+    if ( ( p.features & ( IORING_FEAT_EXT_ARG | IORING_FEAT_CQE_SKIP ) )
+             != ( IORING_FEAT_EXT_ARG | IORING_FEAT_CQE_SKIP )
+         || !probeSendTo() )
+    {
+        close( ringFd ) ;
+        errno = EOPNOTSUPP ;        // for the caller's perror()
+        return 0 ;
+    }
+
+    /* --------------------- Provided buffers for receives --------------- */
+    bufRing = mmap( NULL , NRBUFS * sizeof( struct io_uring_buf ) , PROT_READ | PROT_WRITE ,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE , -1 , 0 ) ;
+    if ( bufRing == MAP_FAILED )
+    {
+        close( ringFd ) ;
+        return 0 ;
+    }
+
+    struct io_uring_buf_reg reg ;
+    memset( &reg , 0 , sizeof( reg ) ) ;
+    reg.ring_addr    = (uint64_t) (uintptr_t) bufRing ;
+    reg.ring_entries = NRBUFS ;
+    reg.bgid         = BGID ;
+    if ( uringRegister( IORING_REGISTER_PBUF_RING , &reg , 1 ) < 0 )
+    {
+        close( ringFd ) ;
+        return 0 ;
+    }
+    for ( int i = 0 ; i < NRBUFS ; i++ )
+        recycleBuf( i ) ;
+
+    memset( &recvTmpl , 0 , sizeof( recvTmpl ) ) ;
+    recvTmpl.msg_namelen = sizeof( struct sockaddr_in ) ;
+
+    /* ------------------------- Queues and eventfds --------------------- */
+    for ( int i = 0 ; i < NSLOTS ; i++ )
+        freeSlots[ i ] = i ;
+    freeTop = NSLOTS ;
+    Sem_init( &slotSem , 0 , NSLOTS ) ;
+    Sem_init( &stopDone , 0 , 0 ) ;
+
+    kickFd  = eventfd( 0 , 0 ) ;
+    readyFd = eventfd( 0 , EFD_NONBLOCK ) ;
+    if ( kickFd < 0 || readyFd < 0 )
+        err_sys( "Could not create eventfd" ) ;
+
+    pthread_t tid ;
+    Pthread_create( &tid , NULL , uringEngine , NULL ) ;
+    Pthread_detach( tid ) ;
+    return 1 ;
+}
+
+/*--------------------------------------------------------------------
+   Pick the engine. Falls back to IO_CLASSIC if io_uring is unavailable
+----------------------------------------------------------------------*/
+int ioInit( int sd , ioEngine_t want )
+{
+    sock   = sd ;
+    engine = IO_CLASSIC ;
+
+    if ( want == IO_URING )
+    {
+        if ( uringInit() )
+            engine = IO_URING ;
+        else
+            perror( "io_uring unavailable, using recvfrom()/sendto()" ) ;
+    }
+
+    return engine ;
+}
+
+//------------------
+
+const char *ioEngineName( void )
+{
+    return engine == IO_URING ? "io_uring" : "recvfrom/sendto" ;
+}
+
+/*--------------------------------------------------------------------
+   Descriptor to poll() for "a datagram may be ready"
+----------------------------------------------------------------------*/
+int ioWaitFd( void )
+{
+    return engine == IO_URING ? readyFd : sock ;
+}
+
+/*--------------------------------------------------------------------
+   About to block in poll() on ioWaitFd(): with io_uring, tell deliver()
+   to raise readyFd for the next datagram, resetting it first if it was
+   raised. Datagrams that arrive while main is busy cost no signal, and
+   spinning callers skip this and pay no syscall per empty check
+----------------------------------------------------------------------*/
+void ioArmWait( void )
+{
+    uint64_t v = 1 ;
+
+    if ( engine != IO_URING )
+        return ;
+
+    pthread_mutex_lock( &lock ) ;
+    if ( rqCount > 0 )
+    {
+        // Queued since the caller looked: make poll() return at once
+        if ( !readyRaised )
+        {
+            COUNT( syscalls , 1 ) ;
+            if ( write( readyFd , &v , sizeof( v ) ) < 0 )
+                perror( "io_uring engine: write(readyFd)" ) ;
+            readyRaised = 1 ;
+        }
+    }
+    else
+    {
+        if ( readyRaised )
+        {
+            COUNT( syscalls , 1 ) ;
+            if ( read( readyFd , &v , sizeof( v ) ) < 0 && errno != EAGAIN )
+                perror( "io_uring engine: read(readyFd)" ) ;
+            readyRaised = 0 ;
+        }
+        mainAsleep = 1 ;
+    }
+    pthread_mutex_unlock( &lock ) ;
+}
+
+/*--------------------------------------------------------------------
+   Non-blocking receive. Returns 0, or -1 with errno EAGAIN if nothing
+   is waiting (or receiving was stopped)
+----------------------------------------------------------------------*/
+int ioRecv( msgBuf *m , struct sockaddr_in *from )
+{
+    if ( engine == IO_CLASSIC )
+    {
+        socklen_t alen = sizeof( *from ) ;
+
+        if ( recvStopped )
+        {
+            errno = EAGAIN ;
+            return -1 ;
+        }
+
+        COUNT( syscalls , 1 ) ;
+        if ( recvfrom( sock , m , sizeof( *m ) , MSG_DONTWAIT , (SA *) from , &alen ) < 0 )
+            return -1 ;
+
+        COUNT( datagramsIn , 1 ) ;
+        return 0 ;
+    }
+
+    // Peek without the lock: an empty check costs neither a syscall
+    // nor a cache line fought over with the ring thread
+    if ( __atomic_load_n( &rqCount , __ATOMIC_ACQUIRE ) == 0 )
+    {
+        errno = EAGAIN ;
+        return -1 ;
+    }
+
+    pthread_mutex_lock( &lock ) ;
+    *m    = rq[ rqHead ].msg ;
+    *from = rq[ rqHead ].from ;
+    rqHead = ( rqHead + 1 ) % RQ_SIZE ;
+    __atomic_fetch_sub( &rqCount , 1 , __ATOMIC_RELAXED ) ;
+    pthread_mutex_unlock( &lock ) ;
+    return 0 ;
+}
+
+/*--------------------------------------------------------------------
+   Send one message. With io_uring the message is copied into a send
+   slot and queued on the ring, where the engine's next timed wake-up
+   submits it with whatever else is queued
+----------------------------------------------------------------------*/
+void ioSend( msgBuf *m , struct sockaddr_in *to )
+{
+    if ( engine == IO_CLASSIC )
+    {
+        COUNT( syscalls , 1 ) ;
+        if ( sendto( sock , m , sizeof( *m ) , 0 , (SA *) to , sizeof( *to ) ) >= 0 )
+            COUNT( datagramsOut , 1 ) ;
+        else
+            sendFailed( errno ) ;
+        return ;
+    }
+
+    Sem_wait( &slotSem ) ;
+
+    pthread_mutex_lock( &lock ) ;
+    int slot = freeSlots[ --freeTop ] ;
+    slots[ slot ].msg = *m ;
+    slots[ slot ].to  = *to ;
+
+    // An idle engine would not submit this until a datagram arrives:
+    // submit it ourselves. If sends are coming thick and fast, let its
+    // completion wake the engine so the ones that follow are batched
+    double now  = monoMs() ;
+    int    idle = ( engineState == ENGINE_IDLE ) ;
+    int    wake = idle && sendMs[ 1 ] - sendMs[ 0 ] < FLUSH_NS / 1e6
+                       && now - sendMs[ 1 ]         < FLUSH_NS / 1e6 ;
+    sendMs[ 0 ] = sendMs[ 1 ] ;
+    sendMs[ 1 ] = now ;
+    if ( wake )
+        engineState = ENGINE_BUSY ;
+
+    if ( !prepSend( slot , wake ) )
+    {
+        if ( wake )
+            engineState = ENGINE_IDLE ;
+        freeSlots[ freeTop++ ] = slot ;
+        pthread_mutex_unlock( &lock ) ;
+        Sem_post( &slotSem ) ;
+        sendFailed( EBUSY ) ;
+        return ;
+    }
+    COUNT( datagramsOut , 1 ) ;
+    if ( !idle || wake )
+        sendsSeen++ ;
+
+    // Nor should a full batch wait for the timer
+    if ( idle || sqLocalTail - __atomic_load_n( sqHead , __ATOMIC_ACQUIRE ) >= FLUSH_BATCH )
+        submitQueued() ;
+    pthread_mutex_unlock( &lock ) ;
+}
+
+/*--------------------------------------------------------------------
+   Stop taking datagrams off the socket (it has been handed off).
+   Anything already queued can still be drained with ioRecv()
+----------------------------------------------------------------------*/
+void ioStopRecv( void )
+{
+    if ( engine == IO_CLASSIC )
+    {
+        recvStopped = 1 ;
+        return ;
+    }
+
+    pthread_mutex_lock( &lock ) ;
+    int first = !stopRequested ;
+    stopRequested = 1 ;
+    pthread_mutex_unlock( &lock ) ;
+
+    if ( first )
+    {
+        uint64_t one = 1 ;
+        if ( write( kickFd , &one , sizeof( one ) ) < 0 )
+            perror( "io_uring engine: write(kickFd)" ) ;
+        Sem_wait( &stopDone ) ;
+    }
+}
+
+//------------------
+
+void ioGetStats( ioStats *st )
+{
+    st->syscalls     = __atomic_load_n( &stats.syscalls     , __ATOMIC_RELAXED ) ;
+    st->datagramsIn  = __atomic_load_n( &stats.datagramsIn  , __ATOMIC_RELAXED ) ;
+    st->datagramsOut = __atomic_load_n( &stats.datagramsOut , __ATOMIC_RELAXED ) ;
+    st->drops        = __atomic_load_n( &stats.drops        , __ATOMIC_RELAXED ) ;
+    st->sendErrors   = __atomic_load_n( &stats.sendErrors   , __ATOMIC_RELAXED ) ;
+}
@@ -0,0 +1,38 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : ioengine.h
+//---------------------------------------------------------------------
+
+#ifndef  IOENGINE_H
+#define  IOENGINE_H
+
+#include <netinet/in.h>
+
+#include "message.h"
+
+typedef enum
+{
+    IO_CLASSIC = 1 , IO_URING
+} ioEngine_t ;
+
+/* ----------------- Counters for comparing the two engines -------------- */
+typedef struct {
+    unsigned long  syscalls ,      /* every syscall made for socket I/O   */
+                   datagramsIn ,
+                   datagramsOut ,
+                   drops ,         /* received but no room to queue       */
+                   sendErrors ;    /* sends the kernel failed             */
+} ioStats ;
+
+int   ioInit( int sd , ioEngine_t want ) ;   /* returns the engine in use */
+int   ioWaitFd( void ) ;
+void  ioArmWait( void ) ;                    /* call right before poll()  */
+int   ioRecv( msgBuf *m , struct sockaddr_in *from ) ;
+void  ioSend( msgBuf *m , struct sockaddr_in *to ) ;
+void  ioStopRecv( void ) ;
+void  ioGetStats( ioStats *st ) ;
+const char *ioEngineName( void ) ;
+
+#endif
@@ -0,0 +1,532 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : journal.c
+//
+// Append-only order journal in a memory-mapped file. Appending is a
+// copy into the mapping; one flusher thread msync()s for everybody
+// waiting, so a burst of claims shares one trip to the disk (group
+// commit). When the file fills up it is rewritten with just the orders
+// still in progress. A restarted factory replays it to find them.
+//---------------------------------------------------------------------
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "wrappers.h"
+#include "journal.h"
+
+typedef struct {
+    uint32_t  magic ,
+              version ,
+              recSize ;
+    char      pad[ 52 ] ;
+} jrHeader ;
+
+#define JOURNAL_BYTES  ( sizeof( jrHeader ) + (size_t) JOURNAL_RECORDS * sizeof( jrRecord ) )
+
+int journalOn = 0 ;
+
+static char      *path ;
+static char      *region ;          /* the whole mapped file               */
+static jrRecord  *recs ;            /* just past the header                */
+static uint64_t   nextSeq ,         /* sequence number of the next record  */
+                  first ,           /* sequence number held in recs[ 0 ]   */
+                  syncedSeq ;       /* every record before it is on disk   */
+static int        syncWanted ;
+static jrStats    stats ;
+
+// Appenders share the mapping; compaction swaps it out from under them
+static pthread_rwlock_t  mapLock  = PTHREAD_RWLOCK_INITIALIZER ;
+static pthread_mutex_t   syncLock = PTHREAD_MUTEX_INITIALIZER ;
+static pthread_cond_t    wantSync = PTHREAD_COND_INITIALIZER ,
+                         didSync  = PTHREAD_COND_INITIALIZER ;
+
+static void     *flusher( void *arg ) ;
+static uint64_t  append( jrRecord *r ) ;
+
+/*--------------------------------------------------------------------
+   Map a journal file, creating it if need be
+----------------------------------------------------------------------*/
+static char *mapFile( const char *p )
+{
+    struct stat sb ;
+    int fd = open( p , O_RDWR | O_CREAT , S_IRUSR | S_IWUSR ) ;
+
+    if ( fd < 0 || fstat( fd , &sb ) < 0 )
+        err_sys( "Could not open the journal" ) ;
+
+    int fresh = ( sb.st_size == 0 ) ;
+    if ( !fresh && sb.st_size != (off_t) JOURNAL_BYTES )
+        err_quit( "Journal file has the wrong size\n" ) ;
+    if ( fresh && ftruncate( fd , JOURNAL_BYTES ) < 0 )
+        err_sys( "Could not size the journal" ) ;
+
+    char *m = mmap( NULL , JOURNAL_BYTES , PROT_READ | PROT_WRITE , MAP_SHARED , fd , 0 ) ;
+    if ( m == MAP_FAILED )
+        err_sys( "Could not map the journal" ) ;
+    close( fd ) ;
+
+    jrHeader *h = (jrHeader *) m ;
+    if ( fresh )
+    {
+        h->magic   = JOURNAL_MAGIC ;
+        h->version = JOURNAL_VERSION ;
+        h->recSize = sizeof( jrRecord ) ;
+    }
+    else if ( h->magic != JOURNAL_MAGIC || h->version != JOURNAL_VERSION
+              || h->recSize != sizeof( jrRecord ) )
+        err_quit( "Not an order journal of this version\n" ) ;
+
+    return m ;
+}
+
+//------------------
+
+static int *lookup( int *slot , unsigned mask , jrOrder *orders , jrRecord *e )
+{
+    unsigned i = ( e->ip * 2654435761u ^ e->port * 40503u ^ e->orderID * 2246822519u ) & mask ;
+
+    while ( slot[ i ] >= 0 )
+    {
+        jrOrder *o = &orders[ slot[ i ] ] ;
+        if ( o->ip == e->ip && o->port == e->port && o->orderID == e->orderID )
+            break ;
+        i = ( i + 1 ) & mask ;
+    }
+    return &slot[ i ] ;
+}
+
+/*--------------------------------------------------------------------
+   Fold 'n' records into orders. Returns how many are unfinished; they
+   are in a malloc()ed array at '*out'
+----------------------------------------------------------------------*/
+static int replay( jrRecord *r , uint64_t n , jrOrder **out )
+{
+    int admits = 0 , count = 0 , kept = 0 ;
+
+    for ( uint64_t i = 0 ; i < n ; i++ )
+        admits += ( r[ i ].type == JR_ADMIT ) ;
+
+    unsigned slots = 16 ;
+    while ( slots < 2u * admits )
+        slots <<= 1 ;
+
+    int     *slot   = malloc( slots * sizeof( int ) ) ;
+    jrOrder *orders = calloc( admits + 1 , sizeof( jrOrder ) ) ;
+    if ( slot == NULL || orders == NULL )
+        err_quit( "Out of memory replaying the journal\n" ) ;
+    memset( slot , -1 , slots * sizeof( int ) ) ;
+
+    for ( uint64_t i = 0 ; i < n ; i++ )
+    {
+        jrRecord *e = &r[ i ] ;
+        if ( e->type == 0 )
+            continue ;                      // reserved, never written
+
+        int     *s = lookup( slot , slots - 1 , orders , e ) ;
+        jrOrder *o = *s >= 0 ? &orders[ *s ] : NULL ;
+        int      f = e->facID ;
+
+        if ( e->type == JR_ADMIT )
+        {
+            if ( e->numFac < 1 || e->numFac > MAXFACTORIES )
+                continue ;
+            if ( o == NULL )
+            {
+                *s = count ;
+                o  = &orders[ count++ ] ;
+            }
+            memset( o , 0 , sizeof( jrOrder ) ) ;
+            o->ip        = e->ip ;
+            o->port      = e->port ;
+            o->orderID   = e->orderID ;
+            o->numFac    = e->numFac ;
+            o->orderSize = e->orderSize ;
+            o->fromStock = e->fromStock ;
+            continue ;
+        }
+
+        // Anything else belongs to an order admitted earlier
+        if ( o == NULL )
+            continue ;
+
+        switch ( e->type )
+        {
+            case JR_CLAIM :
+                if ( f == 0 )
+                {
+                    o->stockSent = 1 ;      // already counted in fromStock
+                    break ;
+                }
+                if ( f < 1 || f > o->numFac )
+                    break ;
+                o->partsMade      += e->parts ;
+                o->facParts[ f ]  += e->parts ;
+                o->facIters[ f ]  += e->iterations ;
+                break ;
+
+            case JR_FACDONE :
+                if ( f >= 1 && f <= o->numFac )
+                    o->facDone[ f ] = 1 ;
+                break ;
+
+            case JR_DONE :
+                o->done = 1 ;
+                break ;
+        }
+    }
+
+    for ( int i = 0 ; i < count ; i++ )
+        if ( !orders[ i ].done )
+            orders[ kept++ ] = orders[ i ] ;
+
+    free( slot ) ;
+    *out = orders ;
+    return kept ;
+}
+
+/*--------------------------------------------------------------------
+   The fewest records that say all an order's old ones did: one per
+   order, stock delivery and sub-factory. 'r' must be zeroed and have
+   room for ORDER_RECORDS. Returns how many were filled in
+----------------------------------------------------------------------*/
+#define ORDER_RECORDS  ( 2 * MAXFACTORIES + 2 )
+
+static int orderRecords( jrOrder *o , jrRecord *r )
+{
+    int k = 0 ;
+
+    r[ k ].type      = JR_ADMIT ;
+    r[ k ].orderSize = o->orderSize ;
+    r[ k ].fromStock = o->fromStock ;
+    r[ k ].numFac    = o->numFac ;
+    k++ ;
+
+    if ( o->stockSent )
+    {
+        r[ k ].type  = JR_CLAIM ;
+        r[ k ].parts = o->fromStock ;
+        k++ ;
+    }
+
+    for ( int f = 1 ; f <= o->numFac ; f++ )
+    {
+        if ( o->facParts[ f ] > 0 )
+        {
+            r[ k ].type       = JR_CLAIM ;
+            r[ k ].facID      = f ;
+            r[ k ].parts      = o->facParts[ f ] ;
+            r[ k ].iterations = o->facIters[ f ] ;
+            k++ ;
+        }
+        if ( o->facDone[ f ] )
+        {
+            r[ k ].type  = JR_FACDONE ;
+            r[ k ].facID = f ;
+            k++ ;
+        }
+    }
+
+    for ( int i = 0 ; i < k ; i++ )
+    {
+        r[ i ].ip      = o->ip ;
+        r[ i ].port    = o->port ;
+        r[ i ].orderID = o->orderID ;
+    }
+    return k ;
+}
+
+//------------------
+
+static uint64_t lastUsed( jrRecord *r )
+{
+    // Slots are filled in any order; the journal ends at the last one used
+    uint64_t n = JOURNAL_RECORDS ;
+    while ( n > 0 && r[ n - 1 ].type == 0 )
+        n-- ;
+    return n ;
+}
+
+/*--------------------------------------------------------------------
+   Replace the journal with a fresh one holding only 'orders'. The new
+   file is complete on disk before it takes the old one's name.
+   Returns how many records it holds
+----------------------------------------------------------------------*/
+static uint64_t rewrite( jrOrder *orders , int n )
+{
+    char tmp[ 512 ] ;
+    snprintf( tmp , sizeof( tmp ) , "%s.tmp" , path ) ;
+    unlink( tmp ) ;
+
+    char     *m = mapFile( tmp ) ;
+    jrRecord *r = (jrRecord *) ( m + sizeof( jrHeader ) ) ;
+    uint64_t  k = 0 ;
+
+    for ( int i = 0 ; i < n ; i++ )
+        k += orderRecords( &orders[ i ] , &r[ k ] ) ;
+
+    if ( msync( m , JOURNAL_BYTES , MS_SYNC ) < 0 )
+        err_sys( "Could not sync the journal" ) ;
+    if ( rename( tmp , path ) < 0 )
+        err_sys( "Could not replace the journal" ) ;
+
+    if ( region != NULL )
+        munmap( region , JOURNAL_BYTES ) ;
+    region = m ;
+    recs   = r ;
+
+    return k ;
+}
+
+/*--------------------------------------------------------------------
+   Open (or create) the journal at 'p'. Returns how many orders it
+   holds that never finished; they are in a malloc()ed array at
+   '*unfinished'. The journal then starts over with just those
+----------------------------------------------------------------------*/
+int journalOpen( const char *p , jrOrder **unfinished )
+{
+    path   = strdup( p ) ;
+    region = mapFile( path ) ;
+    recs   = (jrRecord *) ( region + sizeof( jrHeader ) ) ;
+
+    int count = replay( recs , lastUsed( recs ) , unfinished ) ;
+
+    nextSeq   = rewrite( *unfinished , count ) ;
+    first     = 0 ;
+    syncedSeq = nextSeq ;
+    journalOn = 1 ;
+
+    pthread_t tid ;
+    Pthread_create( &tid , NULL , flusher , NULL ) ;
+    Pthread_detach( tid ) ;
+
+    return count ;
+}
+
+/*--------------------------------------------------------------------
+   Take over the journal at 'p' of a factory that has gone: its
+   unfinished orders are copied into ours and the file is removed.
+   Returns how many there were, in a malloc()ed array at '*unfinished'
+----------------------------------------------------------------------*/
+int journalAdopt( const char *p , jrOrder **unfinished )
+{
+    struct stat sb ;
+
+    *unfinished = NULL ;
+    if ( stat( p , &sb ) < 0 )
+        return 0 ;                          // it kept no journal
+    if ( sb.st_size != (off_t) JOURNAL_BYTES )
+    {
+        fprintf( stderr , "Journal '%s' has the wrong size; not adopted\n" , p ) ;
+        return 0 ;
+    }
+
+    char     *m     = mapFile( p ) ;
+    jrRecord *r     = (jrRecord *) ( m + sizeof( jrHeader ) ) ;
+    int       count = replay( r , lastUsed( r ) , unfinished ) ;
+    uint64_t  seq   = 0 ;
+
+    for ( int i = 0 ; i < count ; i++ )
+    {
+        jrRecord batch[ ORDER_RECORDS ] ;
+        memset( batch , 0 , sizeof( batch ) ) ;
+
+        int k = orderRecords( &( *unfinished )[ i ] , batch ) ;
+        for ( int j = 0 ; j < k ; j++ )
+            seq = append( &batch[ j ] ) ;
+    }
+
+    // Ours must hold them before theirs goes away
+    if ( seq > 0 )
+        journalSync( seq ) ;
+
+    munmap( m , JOURNAL_BYTES ) ;
+    unlink( p ) ;
+    return count ;
+}
+
+/*--------------------------------------------------------------------
+   The journal is full: start a new one with the orders in progress
+----------------------------------------------------------------------*/
+static void compact( void )
+{
+    pthread_rwlock_wrlock( &mapLock ) ;
+
+    // Somebody else may have got here first
+    if ( nextSeq - first >= JOURNAL_RECORDS )
+    {
+        jrOrder *orders ;
+        int      n = replay( recs , JOURNAL_RECORDS , &orders ) ;
+
+        first = nextSeq - rewrite( orders , n ) ;
+        free( orders ) ;
+
+        pthread_mutex_lock( &syncLock ) ;
+        syncedSeq = nextSeq ;
+        stats.compactions++ ;
+        pthread_cond_broadcast( &didSync ) ;
+        pthread_mutex_unlock( &syncLock ) ;
+    }
+
+    pthread_rwlock_unlock( &mapLock ) ;
+}
+
+/*--------------------------------------------------------------------
+   Copy 'r' into the next slot. Its type goes in last, so a slot cut
+   short by a crash reads as empty. Returns the sequence number to
+   pass to journalSync()
+----------------------------------------------------------------------*/
+static uint64_t append( jrRecord *r )
+{
+    uint32_t type = r->type ;
+
+    r->type = 0 ;
+    while ( 1 )
+    {
+        pthread_rwlock_rdlock( &mapLock ) ;
+        uint64_t seq = __atomic_fetch_add( &nextSeq , 1 , __ATOMIC_RELAXED ) ;
+
+        if ( seq - first < JOURNAL_RECORDS )
+        {
+            jrRecord *e = &recs[ seq - first ] ;
+            *e = *r ;
+            __atomic_store_n( &e->type , type , __ATOMIC_RELEASE ) ;
+            pthread_rwlock_unlock( &mapLock ) ;
+
+            __atomic_fetch_add( &stats.records , 1 , __ATOMIC_RELAXED ) ;
+            return seq + 1 ;
+        }
+
+        pthread_rwlock_unlock( &mapLock ) ;
+        compact() ;
+    }
+}
+
+//------------------
+
+uint64_t journalAdmit( struct sockaddr_in *c , unsigned orderID ,
+                       uint64_t orderSize , uint64_t fromStock , int numFac )
+{
+    jrRecord r ;
+
+    memset( &r , 0 , sizeof( r ) ) ;
+    r.type      = JR_ADMIT ;
+    r.ip        = c->sin_addr.s_addr ;
+    r.port      = c->sin_port ;
+    r.orderID   = orderID ;
+    r.orderSize = orderSize ;
+    r.fromStock = fromStock ;
+    r.numFac    = numFac ;
+
+    return append( &r ) ;
+}
+
+/*--------------------------------------------------------------------
+   JR_CLAIM ( 'parts' made by 'facID' ), JR_FACDONE or JR_DONE
+----------------------------------------------------------------------*/
+uint64_t journalLog( int type , struct sockaddr_in *c , unsigned orderID ,
+                     int facID , uint64_t parts )
+{
+    jrRecord r ;
+
+    memset( &r , 0 , sizeof( r ) ) ;
+    r.type       = type ;
+    r.ip         = c->sin_addr.s_addr ;
+    r.port       = c->sin_port ;
+    r.orderID    = orderID ;
+    r.facID      = facID ;
+    r.parts      = parts ;
+    r.iterations = ( type == JR_CLAIM ) ;
+
+    return append( &r ) ;
+}
+
+/*--------------------------------------------------------------------
+   Block until every record before 'seq' is on disk. Whoever asks while
+   a sync is under way is covered by the next one
+----------------------------------------------------------------------*/
+void journalSync( uint64_t seq )
+{
+    pthread_mutex_lock( &syncLock ) ;
+    while ( syncedSeq < seq )
+    {
+        if ( !syncWanted )
+        {
+            syncWanted = 1 ;
+            pthread_cond_signal( &wantSync ) ;
+        }
+        pthread_cond_wait( &didSync , &syncLock ) ;
+    }
+    pthread_mutex_unlock( &syncLock ) ;
+}
+
+//------------------
+
+void journalGetStats( jrStats *st )
+{
+    pthread_mutex_lock( &syncLock ) ;
+    *st = stats ;
+    st->records = __atomic_load_n( &stats.records , __ATOMIC_RELAXED ) ;
+    pthread_mutex_unlock( &syncLock ) ;
+}
+
+/*--------------------------------------------------------------------
+   msync() the pages holding records [from, upto). Caller holds mapLock
+----------------------------------------------------------------------*/
+static void syncRange( uint64_t from , uint64_t upto )
+{
+    uint64_t lo = from > first ? from - first : 0 ;
+    uint64_t hi = upto - first ;
+    if ( hi > JOURNAL_RECORDS )
+        hi = JOURNAL_RECORDS ;
+    if ( hi <= lo )
+        return ;
+
+    size_t page  = (size_t) sysconf( _SC_PAGESIZE ) ;
+    size_t start = ( sizeof( jrHeader ) + lo * sizeof( jrRecord ) ) & ~( page - 1 ) ;
+    size_t end   = sizeof( jrHeader ) + hi * sizeof( jrRecord ) ;
+
+    if ( msync( region + start , end - start , MS_SYNC ) < 0 )
+        err_sys( "Could not sync the journal" ) ;
+}
+
+/*--------------------------------------------------------------------
+   Flusher: one msync() per round, for every record appended so far
+----------------------------------------------------------------------*/
+static void *flusher( void *arg )
+{
+    (void) arg ;
+
+    while ( 1 )
+    {
+        pthread_mutex_lock( &syncLock ) ;
+        while ( !syncWanted )
+            pthread_cond_wait( &wantSync , &syncLock ) ;
+        syncWanted = 0 ;
+        uint64_t      from = syncedSeq ;
+        unsigned long gen  = stats.compactions ;
+        pthread_mutex_unlock( &syncLock ) ;
+
+        // With no appender inside, every slot reserved below 'upto' is
+        // completely written
+        pthread_rwlock_wrlock( &mapLock ) ;
+        uint64_t upto = nextSeq ;
+        pthread_rwlock_unlock( &mapLock ) ;
+
+        pthread_rwlock_rdlock( &mapLock ) ;
+        if ( stats.compactions == gen )     // else the rewrite synced them
+            syncRange( from , upto ) ;
+        pthread_rwlock_unlock( &mapLock ) ;
+
+        pthread_mutex_lock( &syncLock ) ;
+        if ( upto > syncedSeq )
+            syncedSeq = upto ;
+        stats.syncs++ ;
+        pthread_cond_broadcast( &didSync ) ;
+        pthread_mutex_unlock( &syncLock ) ;
+    }
+
+    return NULL ;
+}
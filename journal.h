@@ -0,0 +1,74 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : journal.h
+//---------------------------------------------------------------------
+
+#ifndef  JOURNAL_H
+#define  JOURNAL_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "message.h"
+
+#define JOURNAL_MAGIC    0x5432354a   /* "T25J" */
+#define JOURNAL_VERSION  2
+#define JOURNAL_RECORDS  ( 1 << 20 )  /* 64-byte records: a 64 MB file */
+
+typedef enum
+{
+    JR_ADMIT = 1 , JR_CLAIM , JR_FACDONE , JR_DONE
+} jrType_t ;
+
+/* ------------ One journal record; 'type' is written last --------------- */
+typedef struct {
+    uint32_t  type ;           /* jrType_t; 0 = slot never completed      */
+    uint32_t  orderID ;
+    uint32_t  ip ;             /* client address, network order           */
+    uint16_t  port ;
+    int16_t   facID ;          /* JR_CLAIM (0 = from stock), JR_FACDONE   */
+    uint64_t  orderSize ,      /* JR_ADMIT                                */
+              fromStock ,      /* JR_ADMIT                                */
+              parts ;          /* JR_CLAIM                                */
+    int32_t   numFac ,         /* JR_ADMIT                                */
+              iterations ;     /* JR_CLAIM: claims folded into this one   */
+    char      pad[ 16 ] ;
+} jrRecord ;
+
+/* -------------- An unfinished order rebuilt from the journal ----------- */
+typedef struct {
+    uint32_t  ip ;
+    uint16_t  port ;
+    unsigned  orderID ;
+    int       numFac ,
+              done ,
+              stockSent ;
+    uint64_t  orderSize ,
+              fromStock ,
+              partsMade ;
+    uint64_t  facParts[ MAXFACTORIES + 1 ] ;
+    int       facIters[ MAXFACTORIES + 1 ] ,
+              facDone[ MAXFACTORIES + 1 ] ;
+} jrOrder ;
+
+/* --------------------------- Counters ---------------------------------- */
+typedef struct {
+    unsigned long  records ,
+                   syncs ,          /* msync()s, each covering a group     */
+                   compactions ;
+} jrStats ;
+
+extern int journalOn ;
+
+int       journalOpen( const char *path , jrOrder **unfinished ) ;
+int       journalAdopt( const char *path , jrOrder **unfinished ) ;
+uint64_t  journalAdmit( struct sockaddr_in *c , unsigned orderID ,
+                        uint64_t orderSize , uint64_t fromStock , int numFac ) ;
+uint64_t  journalLog( int type , struct sockaddr_in *c , unsigned orderID ,
+                      int facID , uint64_t parts ) ;
+void      journalSync( uint64_t seq ) ;
+void      journalGetStats( jrStats *st ) ;
+
+#endif
@@ -4,6 +4,7 @@
 // Author     : Mohamed Aboutabl
 //----------------------------------------------------------------------
 #include <stdio.h>
+#include <inttypes.h>
 #include <arpa/inet.h>
 
 #include "message.h"
@@ -16,9 +17,9 @@ void printMsg( msgBuf *m )
     switch ( ntohl( m->purpose ) )
     {
        case PRODUCTION_MSG :
-            printf( "{ PRODUCTION ,FacID=%-3d, Capacity=%-3d, Made=%-4d, duration=%-4dms) }"
+            printf( "{ PRODUCTION ,FacID=%-3d, Capacity=%-3d, Made=%-4" PRIu64 ", duration=%-4dms) }"
                    , ntohl(m->facID) , ntohl(m->capacity) 
-                   , ntohl(m->partsMade) , ntohl(m->duration) ) ;
+                   , getPartsMade( m ) , ntohl(m->duration) ) ;
             break ;
     
         case COMPLETION_MSG :
@@ -26,17 +27,25 @@ void printMsg( msgBuf *m )
             break ;
 
         case REQUEST_MSG :
-            printf( "{ REQUEST    , OrderSz=%-3d }" , ntohl(m->orderSize) ) ;
+            printf( "{ REQUEST    , OrderSz=%-3" PRIu64 " }" , getOrderSize( m ) ) ;
             break ;
 
         case ORDR_CONFIRM :
-            printf( "{ ORDR_CNFRM , numFacThrds=%-3d }" , ntohl(m->numFac) ) ;
+            if ( m->fromStock == 0 && m->stockLeft == 0 )
+                printf( "{ ORDR_CNFRM , numFacThrds=%-3d }" , ntohl(m->numFac) ) ;
+            else
+                printf( "{ ORDR_CNFRM , numFacThrds=%-3d, FromStock=%u, StockLeft=%u }"
+                       , ntohl(m->numFac) , ntohl(m->fromStock) , ntohl(m->stockLeft) ) ;
             break ;
 
         case PROTOCOL_ERR :
             printf( "{ PROTOCOL_ERROR }" ) ;
             break ;
 
+        case ORDR_DEFER :
+            printf( "{ ORDR_DEFER , retry in %ums }" , ntohl(m->retryMs) ) ;
+            break ;
+
         default :
             printf( "{ UNDEFINED_MSG }" ) ;
             break ;
@@ -44,3 +53,53 @@ void printMsg( msgBuf *m )
 
 }
 
+
+/*--------------------------------------------------------------------
+   64-bit order size and parts count, split across two network-order
+   words so the low word keeps its original place in the message
+----------------------------------------------------------------------*/
+uint64_t getOrderSize( msgBuf *m )
+{
+    return ( (uint64_t) ntohl( m->orderSizeHi ) << 32 ) | ntohl( m->orderSize ) ;
+}
+
+void setOrderSize( msgBuf *m , uint64_t n )
+{
+    m->orderSize   = htonl( (uint32_t) n ) ;
+    m->orderSizeHi = htonl( (uint32_t) ( n >> 32 ) ) ;
+}
+
+uint64_t getPartsMade( msgBuf *m )
+{
+    return ( (uint64_t) ntohl( m->partsMadeHi ) << 32 ) | ntohl( m->partsMade ) ;
+}
+
+void setPartsMade( msgBuf *m , uint64_t n )
+{
+    m->partsMade   = htonl( (uint32_t) n ) ;
+    m->partsMadeHi = htonl( (uint32_t) ( n >> 32 ) ) ;
+}
+
+/*--------------------------------------------------------------------
+   Send-side timestamp, taken as late as possible before sending
+----------------------------------------------------------------------*/
+void stampSend( msgBuf *m )
+{
+    struct timespec ts ;
+    clock_gettime( CLOCK_REALTIME , &ts ) ;
+    m->tsSec  = htonl( (uint32_t) ts.tv_sec ) ;
+    m->tsNsec = htonl( (uint32_t) ts.tv_nsec ) ;
+}
+
+/*--------------------------------------------------------------------
+   Microseconds from 'from' to 'to', clamped to [0, UINT32_MAX]
+----------------------------------------------------------------------*/
+uint32_t usBetween( struct timespec *from , struct timespec *to )
+{
+    int64_t us = ( (int64_t) to->tv_sec - from->tv_sec ) * 1000000
+                 + ( to->tv_nsec - from->tv_nsec ) / 1000 ;
+
+    if ( us < 0 )
+        return 0 ;
+    return us > UINT32_MAX ? UINT32_MAX : (uint32_t) us ;
+}
@@ -7,12 +7,15 @@
 #ifndef  MESSAGE_H
 #define  MESSAGE_H
 #include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
 
 #define MAXFACTORIES    20
 
 typedef enum 
 {
-    PRODUCTION_MSG = 1 , COMPLETION_MSG , REQUEST_MSG , ORDR_CONFIRM , PROTOCOL_ERR 
+    PRODUCTION_MSG = 1 , COMPLETION_MSG , REQUEST_MSG , ORDR_CONFIRM , PROTOCOL_ERR ,
+    ORDR_DEFER          /* client over its rate: re-send after retryMs */
 } msgPurpose_t;
 
 typedef struct {
@@ -26,8 +29,29 @@ typedef struct {
               partsMade ,      /* #of parts made in most recent iteration */
               duration  ;      /* how long it took to make them */
 
+    /* Extensions: appended so peers that send or expect the short message
+       still interoperate (missing words arrive as zero)                  */
+    unsigned  orderSizeHi ,    /* upper 32 bits of orderSize */
+              partsMadeHi ,    /* upper 32 bits of partsMade */
+              units     ,      /* capacity-units batched into this claim */
+              orderID   ,      /* client's tag for the order, echoed back */
+              tsSec     ,      /* CLOCK_REALTIME just before sending   */
+              tsNsec    ,
+              queueUs   ,      /* waiting for work/lock before this claim */
+              makeUs    ,      /* manufacturing time of this claim      */
+              fromStock ,      /* ORDR_CONFIRM: parts served from stock */
+              stockLeft ,      /* ORDR_CONFIRM: stock level afterwards  */
+              retryMs   ;      /* ORDR_DEFER: wait this long, then re-send */
+
 } msgBuf ;
 
-void printMsg( msgBuf *m ) ;
+void      printMsg( msgBuf *m ) ;
+
+uint64_t  getOrderSize( msgBuf *m ) ;
+void      setOrderSize( msgBuf *m , uint64_t n ) ;
+uint64_t  getPartsMade( msgBuf *m ) ;
+void      setPartsMade( msgBuf *m , uint64_t n ) ;
+void      stampSend( msgBuf *m ) ;
+uint32_t  usBetween( struct timespec *from , struct timespec *to ) ;
 
 #endif
\ No newline at end of file
@@ -5,6 +5,8 @@
 // File Name  : procurement.c
 //---------------------------------------------------------------------
 
+#define _GNU_SOURCE             /* recvmmsg() */
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -19,22 +21,245 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <inttypes.h>
 
 #include "wrappers.h"
 #include "message.h"
 
 typedef struct sockaddr SA;
 
+#define RECV_BATCH      32      /* datagrams per recvmmsg() call */
+#define PIPE_RCVBUF     (4 << 20)   /* room for bursts from many orders */
+#define PIPE_IDLE_SEC   10      /* give up after this long without data */
+#define CONFIRM_WAIT_MS 1000    /* re-send a REQUEST_MSG unconfirmed this long */
+#define CONFIRM_TRIES   5       /* ... at most this many times in all */
+#define RESEND_SCAN_MS  100     /* how often pipelined mode looks for them */
+
+/* ----------- Where an order's time went, over all its messages ---------- */
+typedef struct {
+    unsigned long  msgs,        // messages that carried factory timestamps
+                   prodMsgs,    // ... of which were PRODUCTION_MSGs
+                   wireMsgs;    // ... of which had a kernel rx stamp
+    double  queueMs, makeMs, wireMs, stackMs,      // sums
+            queueMax, makeMax, wireMax, stackMax;
+} latencyAgg;
+
+/* ------------- Per-order aggregator for the pipelined mode -------------- */
+typedef struct {
+    int       state;            // ORD_* below; 0 until main publishes it
+    int       numFac;           // sub-factories serving this order
+    int       activeFactories;  // ... still running
+    int       tries;            // REQUEST_MSGs sent for this order
+    unsigned  retryMs;          // deferred: re-send this long after triedAt
+    uint64_t  orderSize;
+    uint64_t  partsMade;
+    struct timeval sentAt,      // REQUEST_MSG sent
+                   confirmAt,   // ORDR_CONFIRM received
+                   doneAt,      // last COMPLETION_MSG received
+                   triedAt;     // REQUEST_MSG last (re-)sent
+    latencyAgg lat;
+} orderAgg;
+
+enum { ORD_SENT = 1 , ORD_RUNNING , ORD_DONE , ORD_FAILED };
+
+/* ---------------- Shared by main and the receiver thread --------------- */
+int        sd;                  // client socket
+struct sockaddr_in *server;     // the factory
+orderAgg  *orders;              // orders[1..numOrders]
+int        numOrders;
+sem_t      window;              // free in-flight slots
+volatile int giveUp = 0;        // receiver timed out; stop sending
+int        resent = 0;          // REQUEST_MSGs sent again (receiver only)
+int        deferred = 0;        // ORDR_DEFERs received (receiver only)
+
+/* ------------------------------ Receive mode ---------------------------- */
+int        busyPollUs = 0;      // spin this long before blocking, 0 = never
+unsigned long rxSpun    = 0;    // receives served while spinning
+unsigned long rxBlocked = 0;    // ... that needed a wakeup
+struct timeval procStart;      // with procStartRu: rxReport()'s baseline
+struct rusage  procStartRu;
+
+double msBetween(struct timeval *from, struct timeval *to)
+{
+    return (to->tv_sec  - from->tv_sec)  * 1000.0 +
+           (to->tv_usec - from->tv_usec) / 1000.0;
+}
+
+int cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+double msBetweenTs(struct timespec *from, struct timespec *to)
+{
+    return (to->tv_sec  - from->tv_sec)  * 1000.0 +
+           (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+/* ------------------------------------------------------------------------
+   Pull the kernel receive timestamp (SO_TIMESTAMPNS) out of a recvmsg()
+   control buffer. Zero if the kernel did not supply one
+   ------------------------------------------------------------------------ */
+void kernelRxTime(struct msghdr *mh, struct timespec *ts)
+{
+    memset(ts, 0, sizeof(*ts));
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(mh); cm != NULL;
+         cm = CMSG_NXTHDR(mh, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS)
+            memcpy(ts, CMSG_DATA(cm), sizeof(*ts));
+    }
+}
+
+/* ------------------------------------------------------------------------
+   recvmmsg() on our socket. In busy-poll mode, first try without waiting
+   for up to busyPollUs microSeconds, then block as 'flags' say (and as
+   SO_RCVTIMEO allows). Only one thread receives at a time
+   ------------------------------------------------------------------------ */
+int spinRecv(struct mmsghdr *mm, unsigned int vlen, int flags)
+{
+    if (busyPollUs > 0) {
+        struct timespec from, now;
+        clock_gettime(CLOCK_MONOTONIC, &from);
+        do {
+            int n = recvmmsg(sd, mm, vlen, MSG_DONTWAIT, NULL);
+            if (n > 0) {
+                rxSpun++;
+                return n;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                return -1;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        } while (msBetweenTs(&from, &now) * 1000.0 < busyPollUs);
+    }
+
+    int n = recvmmsg(sd, mm, vlen, flags, NULL);
+    if (n > 0)
+        rxBlocked++;
+    return n;
+}
+
+/* What the receive mode cost us: spinning shows up as CPU time */
+void rxReport(void)
+{
+    struct rusage  ru;
+    struct timeval now;
+
+    getrusage(RUSAGE_SELF, &ru);
+    gettimeofday(&now, NULL);
+
+    // Only what we spent since procStart: not the loader's or libc's start-up
+    double userMs = msBetween(&procStartRu.ru_utime, &ru.ru_utime),
+           sysMs  = msBetween(&procStartRu.ru_stime, &ru.ru_stime);
+
+    if (busyPollUs > 0)
+        printf("\nReceive (busy-poll %d uSec): ", busyPollUs);
+    else
+        printf("\nReceive (blocking): ");
+    printf("%lu receives served spinning, %lu after a wakeup\n",
+           rxSpun, rxBlocked);
+    printf("CPU time                 = %.1f mSec user + %.1f mSec sys,"
+           " %.1f%% of one core\n",
+           userMs, sysMs,
+           100.0 * (userMs + sysMs) / msBetween(&procStart, &now));
+}
+
+/* ------------------------------------------------------------------------
+   Account one PRODUCTION or COMPLETION message:
+     queueing      - sub-factory waited for work / the order lock
+     manufacturing - the claim itself
+     on-wire       - factory send call until our kernel received it
+                     (sender's stack + network; assumes synced clocks)
+     in-stack      - our kernel received it until we read it
+   ------------------------------------------------------------------------ */
+void latAdd(latencyAgg *a, msgBuf *m, struct timespec *kernRx,
+            struct timespec *userRx)
+{
+    if (m->tsSec == 0)
+        return;                 // legacy factory: no timestamps
+
+    double q = ntohl(m->queueUs) / 1000.0,
+           k = ntohl(m->makeUs)  / 1000.0;
+
+    a->msgs++;
+    a->queueMs += q;   if (q > a->queueMax) a->queueMax = q;
+
+    if (ntohl(m->purpose) == PRODUCTION_MSG) {
+        a->prodMsgs++;
+        a->makeMs += k;    if (k > a->makeMax)  a->makeMax  = k;
+    }
+
+    if (kernRx->tv_sec == 0)
+        return;
+
+    struct timespec sentAt = { ntohl(m->tsSec), ntohl(m->tsNsec) };
+    double w = msBetweenTs(&sentAt, kernRx),
+           s = msBetweenTs(kernRx, userRx);
+
+    a->wireMsgs++;
+    a->wireMs  += w;   if (w > a->wireMax)  a->wireMax  = w;
+    a->stackMs += s;   if (s > a->stackMax) a->stackMax = s;
+}
+
+//------------------
+
+void latMerge(latencyAgg *into, latencyAgg *a)
+{
+    into->msgs     += a->msgs;
+    into->prodMsgs += a->prodMsgs;
+    into->wireMsgs += a->wireMsgs;
+    into->queueMs  += a->queueMs;
+    into->makeMs   += a->makeMs;
+    into->wireMs   += a->wireMs;
+    into->stackMs  += a->stackMs;
+    if (a->queueMax > into->queueMax) into->queueMax = a->queueMax;
+    if (a->makeMax  > into->makeMax)  into->makeMax  = a->makeMax;
+    if (a->wireMax  > into->wireMax)  into->wireMax  = a->wireMax;
+    if (a->stackMax > into->stackMax) into->stackMax = a->stackMax;
+}
+
+//------------------
+
+void latPrint(latencyAgg *a)
+{
+    if (a->msgs == 0) {
+        printf("\nLatency breakdown unavailable: the factory sent no timestamps\n");
+        return;
+    }
+
+    double nw = a->wireMsgs ? a->wireMsgs : 1,
+           np = a->prodMsgs ? a->prodMsgs : 1;
+
+    printf("\nLatency breakdown over %lu messages (milliSeconds)       mean         max\n",
+           a->msgs);
+    printf("    Queueing (waiting for work or the order lock)  %9.3f   %9.3f\n",
+           a->queueMs / a->msgs, a->queueMax);
+    printf("    Manufacturing (per claim)                      %9.3f   %9.3f\n",
+           a->makeMs / np, a->makeMax);
+    printf("    On-wire (factory send call to our kernel)      %9.3f   %9.3f\n",
+           a->wireMs / nw, a->wireMax);
+    printf("    In-stack (our kernel to PROCUREMENT)           %9.3f   %9.3f\n",
+           a->stackMs / nw, a->stackMax);
+}
+
+void *demuxOrders(void *arg);
+void  sendRequest(int id);
+void  runPipelined(struct sockaddr_in *srvrSkt, uint64_t orderSize,
+                   int count, int depth);
+
 /*-------------------------------------------------------*/
 int main(int argc, char *argv[])
 {
     int numFactories,           // total number of factory threads
         activeFactories,        // how many are still running
-        iters[MAXFACTORIES + 1]     = {0},  // iterations per factory
-        partsMade[MAXFACTORIES + 1] = {0},  // parts per factory
-        totalItems = 0;
+        iters[MAXFACTORIES + 1]     = {0};  // iterations per factory
+    uint64_t partsMade[MAXFACTORIES + 1] = {0},  // parts per factory
+             totalItems = 0;
 
     char *myName = "Braden Drake, Aiden Smith";
+    gettimeofday(&procStart, NULL);
+    getrusage(RUSAGE_SELF, &procStartRu);
     printf("\nPROCUREMENT: Started. Developed by %s\n\n", myName);
 
     char myUserName[30];
@@ -45,23 +270,58 @@ int main(int argc, char *argv[])
             myUserName, ctime(&now));
     fflush(stdout);
 
-    if (argc < 4) {
-        printf("PROCUREMENT Usage: %s <order_size> <FactoryServerIP> <port>\n",
-               argv[0]);
+    /* --- Command line: [-n orders] [-w window] [-P spinUsec] size IP port --- */
+    int pipelineOrders = 0,      /* -n: orders to pipeline (0 = classic) */
+        pipelineDepth  = 8;      /* -w: orders kept in flight            */
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:P:")) != -1) {
+        switch (opt) {
+            case 'n':
+                pipelineOrders = atoi(optarg);
+                break;
+            case 'w':
+                pipelineDepth = atoi(optarg);
+                break;
+            case 'P':
+                busyPollUs = atoi(optarg);
+                break;
+            default:
+                printf("PROCUREMENT Usage: %s [-n numOrders] [-w inFlight] [-P spinUsec]"
+                       " <order_size> <FactoryServerIP> <port>\n", argv[0]);
+                exit(-1);
+        }
+    }
+
+    if (argc - optind < 3) {
+        printf("PROCUREMENT Usage: %s [-n numOrders] [-w inFlight] [-P spinUsec]"
+               " <order_size> <FactoryServerIP> <port>\n", argv[0]);
         exit(-1);
     }
 
-    unsigned       orderSize = (unsigned) atoi(argv[1]);
-    char          *serverIP  = argv[2];
-    unsigned short port      = (unsigned short) atoi(argv[3]);
+    uint64_t       orderSize = strtoull(argv[optind], NULL, 10);
+    char          *serverIP  = argv[optind + 1];
+    unsigned short port      = (unsigned short) atoi(argv[optind + 2]);
 
     printf("Attempting Factory server at '%s' : %d\n", serverIP, port);
 
     /* ------------------------- Set up socket --------------------------- */
-    int sd = socket(AF_INET, SOCK_DGRAM, 0);
+    sd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sd < 0)
         err_sys("Could not create socket.");
 
+    // Have the kernel stamp every datagram it receives for us
+    int on = 1;
+    if (setsockopt(sd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0)
+        perror("SO_TIMESTAMPNS unavailable; no in-stack/on-wire breakdown");
+
+    // Busy-poll: let the kernel poll the device queue too, where allowed
+    if (busyPollUs > 0 &&
+        setsockopt(sd, SOL_SOCKET, SO_BUSY_POLL, &busyPollUs, sizeof(busyPollUs)) < 0)
+        perror("SO_BUSY_POLL unavailable; spinning in user space only");
+    if (busyPollUs > 0 && sysconf(_SC_NPROCESSORS_ONLN) < 2)
+        printf("Warning: one CPU online; spinning takes it from everything else\n");
+
     struct sockaddr_in srvrSkt;
     memset((void *) &srvrSkt, 0, sizeof(srvrSkt));
     srvrSkt.sin_family = AF_INET;
@@ -71,11 +331,28 @@ int main(int argc, char *argv[])
                   (void *) &srvrSkt.sin_addr.s_addr) != 1)
         err_sys("Invalid server IP address");
 
+    if (pipelineOrders > 0) {
+        runPipelined(&srvrSkt, orderSize, pipelineOrders,
+                     pipelineDepth < 1 ? 1 : pipelineDepth);
+
+        printf("\n>>> PROCUREMENT  ( by AIDEN SMITH, BRADEN DRAKE ) Terminated\n");
+        if (close(sd) < 0) {
+            perror("Error closing socket.");
+            exit(1);
+        }
+        return 0;
+    }
+
     /* ---------------------- Send REQUEST_MSG --------------------------- */
+    // The order ID is our nonce: a re-sent request carries the same one,
+    // so the factory can tell it from a new order
+    unsigned nonce = ((unsigned) getpid() << 16) ^ (unsigned) now;
+
     msgBuf msg1;
     memset(&msg1, 0, sizeof(msg1));
     msg1.purpose   = htonl(REQUEST_MSG);
-    msg1.orderSize = htonl(orderSize);
+    msg1.orderID   = htonl(nonce ? nonce : 1);
+    setOrderSize(&msg1, orderSize);
 
     sendto(sd, &msg1, sizeof(msg1), 0, (SA *) &srvrSkt, sizeof(srvrSkt));
 
@@ -83,50 +360,123 @@ int main(int argc, char *argv[])
     printMsg(&msg1);
     puts("");
 
-    /* ---------------- Wait for ORDR_CONFIRM from server ---------------- */
-    msgBuf msg2;
-    memset(&msg2, 0, sizeof(msg2));
-    unsigned int alen = sizeof(srvrSkt);
+    /* ------ Wait for ORDR_CONFIRM; collect PRODUCTION & COMPLETION ----- */
+    // One loop for both: if the confirmation is lost, the order's first
+    // messages can beat the re-sent one. They count as in pipelined mode,
+    // COMPLETION_MSGs against the factories the confirmation announces
+    msgBuf incomingMessage;
+    latencyAgg lat;
+    char   ctl[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec  iov = { &incomingMessage, sizeof(incomingMessage) };
+    struct mmsghdr mm;
+    struct msghdr *mh = &mm.msg_hdr;
+    struct timespec kernRx, userRx;
+    struct timeval startTime, endTime, sentAt, tick;
+    int    confirmed = 0, tries = 1;
+
+    memset(&lat, 0, sizeof(lat));
+    numFactories    = 0;
+    activeFactories = 0;
+    gettimeofday(&sentAt, NULL);
 
     printf("\nPROCUREMENT is now waiting for order confirmation ...\n");
 
-    if (recvfrom(sd, &msg2, sizeof(msg2), 0,
-                 (SA *) &srvrSkt, &alen) < 0)
-        err_sys("Error during recvfrom()");
+    // Re-send the request if the confirmation is slow or lost; until it
+    // comes, wake up at least this often to check
+    struct timeval wait = { CONFIRM_WAIT_MS / 1000, (CONFIRM_WAIT_MS % 1000) * 1000 };
+    setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
 
-    printf("PROCUREMENT ( by AIDEN SMITH, BRADEN DRAKE ) received this from the FACTORY server: ");
-    printMsg(&msg2);
-    puts("\n");
+    while (!confirmed || activeFactories > 0) {
+        memset(&incomingMessage, 0, sizeof(incomingMessage));
+        memset(&mm, 0, sizeof(mm));
+        mh->msg_iov        = &iov;
+        mh->msg_iovlen     = 1;
+        mh->msg_control    = ctl;
+        mh->msg_controllen = sizeof(ctl);
+
+        int n = spinRecv(&mm, 1, 0);
+        if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+            err_sys("Error during recvmsg()");
+
+        clock_gettime(CLOCK_REALTIME, &userRx);
+        gettimeofday(&tick, NULL);
+
+        if (!confirmed && msBetween(&sentAt, &tick) >= CONFIRM_WAIT_MS) {
+            if (tries++ == CONFIRM_TRIES)
+                err_quit("PROCUREMENT: No order confirmation; giving up\n");
+
+            printf("PROCUREMENT: No confirmation yet; re-sending the request\n");
+            sendto(sd, &msg1, sizeof(msg1), 0, (SA *) &srvrSkt, sizeof(srvrSkt));
+            sentAt = tick;
+        }
 
-    /* ---------------- Start timing at order confirmation --------------- */
-    struct timeval startTime, endTime;
-    gettimeofday(&startTime, NULL);
+        if (n <= 0)
+            continue;
 
-    numFactories    = (int) ntohl(msg2.numFac);
-    if (numFactories > MAXFACTORIES)
-        numFactories = MAXFACTORIES;
-    activeFactories = numFactories;
+        kernelRxTime(mh, &kernRx);
 
-    /* ------- Collect PRODUCTION & COMPLETION messages from factories --- */
-    msgBuf incomingMessage;
-    unsigned int srvrLen = sizeof(srvrSkt);
+        int purpose = ntohl(incomingMessage.purpose);
+        int facID   = (int) ntohl(incomingMessage.facID);
 
-    while (activeFactories > 0) {
-        memset(&incomingMessage, 0, sizeof(incomingMessage));
+        if (purpose == ORDR_CONFIRM) {
+            if (confirmed)
+                continue;       // our re-sent request, confirmed again
 
-        if (recvfrom(sd, &incomingMessage, sizeof(incomingMessage), 0,
-                     (SA *) &srvrSkt, &srvrLen) < 0)
-            err_sys("Error during recvfrom()");
+            confirmed = 1;
+            struct timeval forever = { 0, 0 };
+            setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &forever, sizeof(forever));
 
-        int purpose = ntohl(incomingMessage.purpose);
-        int facID   = (int) ntohl(incomingMessage.facID);
+            printf("PROCUREMENT ( by AIDEN SMITH, BRADEN DRAKE ) received this from the FACTORY server: ");
+            printMsg(&incomingMessage);
+            puts("\n");
+
+            /* ------------- Start timing at order confirmation ---------- */
+            gettimeofday(&startTime, NULL);
+
+            numFactories = (int) ntohl(incomingMessage.numFac);
+            if (numFactories > MAXFACTORIES)
+                numFactories = MAXFACTORIES;
+            activeFactories += numFactories;
+            continue;
+        }
+
+        if (purpose == ORDR_DEFER) {
+            if (confirmed)
+                continue;
+
+            // We are over our rate at the factory: wait as told, ask again
+            printf("PROCUREMENT: Order deferred by the FACTORY; re-sending in %u mSec\n",
+                   ntohl(incomingMessage.retryMs));
+            Usleep(ntohl(incomingMessage.retryMs) * 1000);
+            sendto(sd, &msg1, sizeof(msg1), 0, (SA *) &srvrSkt, sizeof(srvrSkt));
+            gettimeofday(&sentAt, NULL);
+            continue;
+        }
+
+        // Refused outright: over our limits, or no room for the order
+        if (purpose == PROTOCOL_ERR && !confirmed) {
+            printf("PROCUREMENT ( by AIDEN SMITH, BRADEN DRAKE ): The FACTORY refused the order ");
+            printMsg(&incomingMessage);
+            puts("\n");
+
+            if (close(sd) < 0)
+                perror("Error closing socket.");
+            exit(1);
+        }
+
+        if ((purpose == PRODUCTION_MSG || purpose == COMPLETION_MSG)
+            && (facID < 1 || facID > MAXFACTORIES))
+            continue;
+
+        if (purpose == PRODUCTION_MSG || purpose == COMPLETION_MSG)
+            latAdd(&lat, &incomingMessage, &kernRx, &userRx);
 
         if (purpose == PRODUCTION_MSG) {
-            int parts    = (int) ntohl(incomingMessage.partsMade);
-            int duration = (int) ntohl(incomingMessage.duration);
+            uint64_t parts    = getPartsMade(&incomingMessage);
+            unsigned duration = ntohl(incomingMessage.duration);
 
-            printf("PROCUREMENT  ( by AIDEN SMITH, BRADEN DRAKE ): Factory #%-2d  produced %-5d parts"
-                   " in %-4d milliSecs\n",
+            printf("PROCUREMENT  ( by AIDEN SMITH, BRADEN DRAKE ): Factory #%-2d  produced %-5" PRIu64 " parts"
+                   " in %-4u milliSecs\n",
                    facID, parts, duration);
 
             iters[facID]++;
@@ -164,16 +514,19 @@ int main(int argc, char *argv[])
 
     for (int i = 1; i <= numFactories; i++) {
         totalItems += partsMade[i];
-        printf("           %4d        %8d            %4d\n",
+        printf("           %4d        %8" PRIu64 "            %4d\n",
                i, partsMade[i], iters[i]);
     }
 
     printf("===================================================\n");
-    printf("Grand total parts made   = %5d   vs  order size of %5d\n",
+    printf("Grand total parts made   = %5" PRIu64 "   vs  order size of %5" PRIu64 "\n",
            totalItems, orderSize);
     printf("\nOrder-to-Completion time = %.1f milliSeconds\n",
            elapsed_ms);
 
+    latPrint(&lat);
+    rxReport();
+
     printf("\n>>> PROCUREMENT  ( by AIDEN SMITH, BRADEN DRAKE ) Terminated\n");
 
     if (close(sd) < 0) {
@@ -183,3 +536,338 @@ int main(int argc, char *argv[])
 
     return 0;
 }
+
+/* ======================================================================== */
+/*        Pipelined mode: many tagged orders in flight over one socket      */
+/* ======================================================================== */
+
+void runPipelined(struct sockaddr_in *srvrSkt, uint64_t orderSize,
+                  int count, int depth)
+{
+    pthread_t rtid;
+    struct timeval startTime, endTime;
+
+    numOrders = count;
+    orders    = calloc(count + 1, sizeof(orderAgg));
+    if (orders == NULL)
+        err_quit("Out of memory for order aggregators\n");
+
+    Sem_init(&window, 0, depth);
+
+    // Many orders answer at once: a lost datagram would stall its order,
+    // so ask for a big receive buffer and never wait forever. The
+    // receiver wakes at least every RESEND_SCAN_MS to re-send requests
+    int            rcvBuf = PIPE_RCVBUF;
+    struct timeval wait   = { 0, RESEND_SCAN_MS * 1000 };
+    setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf));
+    setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+
+    server = srvrSkt;
+
+    printf("\nPROCUREMENT pipelining %d orders of %" PRIu64 " parts,"
+           " at most %d in flight\n\n", count, orderSize, depth);
+
+    gettimeofday(&startTime, NULL);
+    Pthread_create(&rtid, NULL, demuxOrders, NULL);
+
+    /* ------------- Issue REQUEST_MSGs as in-flight slots free up ------- */
+    for (int id = 1; id <= count; id++) {
+        Sem_wait(&window);
+        if (giveUp)
+            break;
+
+        // The receiver owns the order once it sees ORD_SENT; the release
+        // store makes the fields above visible to it first
+        orders[id].orderSize = orderSize;
+        orders[id].tries     = 1;
+        gettimeofday(&orders[id].sentAt, NULL);
+        orders[id].triedAt   = orders[id].sentAt;
+        __atomic_store_n(&orders[id].state, ORD_SENT, __ATOMIC_RELEASE);
+
+        sendRequest(id);
+    }
+
+    Pthread_join(rtid, NULL);
+    gettimeofday(&endTime, NULL);
+
+    /* ---------------------- Per-order report --------------------------- */
+    double   *times   = malloc(count * sizeof(double));
+    uint64_t  total   = 0;
+    int       done    = 0,
+              failed  = 0;
+
+    printf("\n\n****** PROCUREMENT  ( by AIDEN SMITH, BRADEN DRAKE ) Pipelined Report ******\n");
+    printf("    Order   Sub-Factories      Parts Made    Confirm(ms)   Complete(ms)\n");
+
+    for (int id = 1; id <= count; id++) {
+        orderAgg *o = &orders[id];
+
+        if (o->state != ORD_DONE) {
+            printf("    %5d   %13s\n", id, "FAILED");
+            failed++;
+            continue;
+        }
+
+        double confirmMs  = msBetween(&o->sentAt, &o->confirmAt);
+        double completeMs = msBetween(&o->sentAt, &o->doneAt);
+
+        times[done++] = completeMs;
+        total += o->partsMade;
+        printf("    %5d   %13d    %12" PRIu64 "    %11.1f   %12.1f\n",
+               id, o->numFac, o->partsMade, confirmMs, completeMs);
+    }
+
+    /* ---------------------- Aggregate report --------------------------- */
+    double wallMs = msBetween(&startTime, &endTime);
+
+    printf("===================================================\n");
+    printf("Orders completed         = %5d   failed = %d\n", done, failed);
+    printf("Requests re-sent         = %5d   deferred by the factory = %d\n",
+           resent, deferred);
+    printf("Grand total parts made   = %5" PRIu64 "   vs  ordered %5" PRIu64 "\n",
+           total, orderSize * (uint64_t) count);
+    printf("\nWall-clock time          = %.1f milliSeconds\n", wallMs);
+    printf("Throughput               = %.1f parts/sec, %.2f orders/sec\n",
+           total * 1000.0 / wallMs, done * 1000.0 / wallMs);
+
+    if (done > 0) {
+        double sum = 0;
+        qsort(times, done, sizeof(double), cmpDouble);
+        for (int i = 0; i < done; i++)
+            sum += times[i];
+
+        printf("Order-to-Completion time = mean %.1f  p50 %.1f  p99 %.1f"
+               "  max %.1f milliSeconds\n",
+               sum / done, times[done / 2], times[(done * 99) / 100],
+               times[done - 1]);
+    }
+
+    /* ------------------ Per-order and overall latency ------------------ */
+    latencyAgg all;
+    memset(&all, 0, sizeof(all));
+
+    printf("\n    Order    mean Queue(ms)    Manufacture(ms)    On-wire(ms)    In-stack(ms)\n");
+    for (int id = 1; id <= count; id++) {
+        latencyAgg *a = &orders[id].lat;
+        if (orders[id].state != ORD_DONE || a->msgs == 0)
+            continue;
+
+        double nw = a->wireMsgs ? a->wireMsgs : 1,
+               np = a->prodMsgs ? a->prodMsgs : 1;
+        printf("    %5d    %14.3f    %15.3f    %11.3f    %12.3f\n",
+               id, a->queueMs / a->msgs, a->makeMs / np,
+               a->wireMs / nw, a->stackMs / nw);
+        latMerge(&all, a);
+    }
+    latPrint(&all);
+    rxReport();
+
+    free(times);
+    free(orders);
+    Sem_destroy(&window);
+}
+
+/* ------------------------------------------------------------------------
+   Send (or re-send) order 'id's REQUEST_MSG, tagged with its order ID
+   ------------------------------------------------------------------------ */
+void sendRequest(int id)
+{
+    msgBuf req;
+
+    memset(&req, 0, sizeof(req));
+    req.purpose = htonl(REQUEST_MSG);
+    req.orderID = htonl(id);
+    setOrderSize(&req, orders[id].orderSize);
+
+    if (sendto(sd, &req, sizeof(req), 0,
+               (SA *) server, sizeof(*server)) < 0)
+        err_sys("Error during sendto()");
+}
+
+/* ------------------------------------------------------------------------
+   Re-send requests still unconfirmed after CONFIRM_WAIT_MS, or deferred
+   ones once their retry time is up; fail those out of tries. Returns
+   how many orders failed
+   ------------------------------------------------------------------------ */
+int resendUnconfirmed(struct timeval *now)
+{
+    int failed = 0;
+
+    for (int id = 1; id <= numOrders; id++) {
+        orderAgg *o = &orders[id];
+
+        if (__atomic_load_n(&o->state, __ATOMIC_ACQUIRE) != ORD_SENT)
+            continue;
+
+        unsigned waitMs = o->retryMs ? o->retryMs : CONFIRM_WAIT_MS;
+        if (msBetween(&o->triedAt, now) < waitMs)
+            continue;
+
+        // A deferral is an answer, not a loss: it costs no try
+        if (o->retryMs) {
+            o->retryMs = 0;
+            o->triedAt = *now;
+            sendRequest(id);
+            continue;
+        }
+
+        if (o->tries == CONFIRM_TRIES) {
+            printf("PROCUREMENT ( by AIDEN SMITH, BRADEN DRAKE ): Order %d never"
+                   " confirmed\n", id);
+            o->state = ORD_FAILED;
+            failed++;
+            Sem_post(&window);
+            continue;
+        }
+
+        o->tries++;
+        o->triedAt = *now;
+        resent++;
+        sendRequest(id);
+    }
+
+    return failed;
+}
+
+/* ------------------------------------------------------------------------
+   An order's last sub-factory is done: free its in-flight slot
+   ------------------------------------------------------------------------ */
+int finishOrder(orderAgg *o, struct timeval *now)
+{
+    o->doneAt = *now;
+    o->state  = ORD_DONE;
+    Sem_post(&window);
+    return 1;
+}
+
+/* ------------------------------------------------------------------------
+   Receiver thread: drain the socket in batches with recvmmsg() and feed
+   each datagram to the aggregator of the order it is tagged with
+   ------------------------------------------------------------------------ */
+void *demuxOrders(void *arg)
+{
+    msgBuf             bufs[RECV_BATCH];
+    struct iovec       iov[RECV_BATCH];
+    struct mmsghdr     mm[RECV_BATCH];
+    char               ctl[RECV_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+    int                finished = 0;
+    struct timeval     lastHeard, lastScan;
+
+    gettimeofday(&lastHeard, NULL);
+    lastScan = lastHeard;
+
+    for (int i = 0; i < RECV_BATCH; i++) {
+        iov[i].iov_base = &bufs[i];
+        iov[i].iov_len  = sizeof(msgBuf);
+    }
+
+    while (finished < numOrders) {
+        memset(mm, 0, sizeof(mm));
+        memset(bufs, 0, sizeof(bufs));
+        for (int i = 0; i < RECV_BATCH; i++) {
+            mm[i].msg_hdr.msg_iov        = &iov[i];
+            mm[i].msg_hdr.msg_iovlen     = 1;
+            mm[i].msg_hdr.msg_control    = ctl[i];
+            mm[i].msg_hdr.msg_controllen = sizeof(ctl[i]);
+        }
+
+        int n = spinRecv(mm, RECV_BATCH, MSG_WAITFORONE);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                err_sys("Error during recvmmsg()");
+            n = 0;
+        }
+
+        struct timeval  now;
+        struct timespec userRx, kernRx;
+        gettimeofday(&now, NULL);
+        clock_gettime(CLOCK_REALTIME, &userRx);
+
+        if (n > 0)
+            lastHeard = now;
+        else if (msBetween(&lastHeard, &now) >= PIPE_IDLE_SEC * 1000.0) {
+            printf("PROCUREMENT ( by AIDEN SMITH, BRADEN DRAKE ): Nothing heard for %d"
+                   " seconds; giving up on %d unfinished orders\n",
+                   PIPE_IDLE_SEC, numOrders - finished);
+            giveUp = 1;
+            Sem_post(&window);
+            break;
+        }
+
+        if (msBetween(&lastScan, &now) >= RESEND_SCAN_MS) {
+            finished += resendUnconfirmed(&now);
+            lastScan  = now;
+        }
+
+        for (int i = 0; i < n; i++) {
+            msgBuf   *m  = &bufs[i];
+            unsigned  id = ntohl(m->orderID);
+
+            if (id < 1 || id > (unsigned) numOrders)
+                continue;
+
+            // Not yet sent by main (a stray datagram), or already settled
+            orderAgg *o     = &orders[id];
+            int       state = __atomic_load_n(&o->state, __ATOMIC_ACQUIRE);
+            if (state == 0 || state == ORD_DONE || state == ORD_FAILED)
+                continue;
+
+            if (ntohl(m->purpose) == PRODUCTION_MSG
+                || ntohl(m->purpose) == COMPLETION_MSG) {
+                kernelRxTime(&mm[i].msg_hdr, &kernRx);
+                latAdd(&o->lat, m, &kernRx, &userRx);
+            }
+
+            switch (ntohl(m->purpose)) {
+                case ORDR_CONFIRM:
+                    if (o->state != ORD_SENT)   // answer to a re-sent request
+                        break;
+
+                    // If the first confirmation was lost, completions may
+                    // have overtaken this one
+                    o->numFac           = (int) ntohl(m->numFac);
+                    o->activeFactories += o->numFac;
+                    o->confirmAt        = now;
+                    o->state            = ORD_RUNNING;
+                    if (o->activeFactories > 0)
+                        break;
+                    finished += finishOrder(o, &now);
+                    break;
+
+                case PRODUCTION_MSG:
+                    o->partsMade += getPartsMade(m);
+                    break;
+
+                case COMPLETION_MSG:
+                    if (--o->activeFactories > 0 || o->state == ORD_SENT)
+                        break;
+                    finished += finishOrder(o, &now);
+                    break;
+
+                case ORDR_DEFER:
+                    if (o->state != ORD_SENT)
+                        break;
+                    o->retryMs = ntohl(m->retryMs) ? ntohl(m->retryMs) : 1;
+                    o->triedAt = now;
+                    deferred++;
+                    break;
+
+                case PROTOCOL_ERR:
+                    printf("PROCUREMENT ( by AIDEN SMITH, BRADEN DRAKE ): Order %u refused ", id);
+                    printMsg(m);
+                    puts("");
+                    o->state = ORD_FAILED;
+                    finished++;
+                    Sem_post(&window);
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+
+    return NULL;
+}
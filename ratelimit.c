@@ -0,0 +1,256 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : ratelimit.c
+//
+// Per-client fair share. Every client address gets two token buckets:
+// one admits orders, the other pays for parts as sub-factories claim
+// them. Bursts are capped at one second's worth. A client may also
+// hold at most 'fairShare' orders at a time. When the table fills up,
+// clients with no order in progress are forgotten, those whose buckets
+// are full again first: a newcomer never shares anybody's entry.
+//---------------------------------------------------------------------
+
+#include "wrappers.h"
+#include "ratelimit.h"
+
+#define SLOT_MASK   ( RL_CLIENTS - 1 )
+
+int rlOn = 0 ;
+
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER ;
+static rlClient  clients[ RL_CLIENTS ] ;
+static int       used ;                         /* slots holding a client */
+static double    orderRate , orderBurst ,      /* 0 rate = unlimited */
+                 partRate  , partBurst ;
+static int       maxActive ;
+
+//------------------
+
+static double lesser( double a , double b )
+{
+    return a <= b ? a : b ;
+}
+
+/*--------------------------------------------------------------------
+   Top up both buckets for the time since the last visit. Caller
+   holds lock
+----------------------------------------------------------------------*/
+static void refill( rlClient *c )
+{
+    double now  = monoMs() ;
+    double secs = ( now - c->lastMs ) / 1000.0 ;
+
+    c->orderTokens = lesser( orderBurst , c->orderTokens + orderRate * secs ) ;
+    c->partTokens  = lesser( partBurst  , c->partTokens  + partRate  * secs ) ;
+    c->lastMs      = now ;
+}
+
+//------------------
+
+void rlInit( double ordersPerSec , double partsPerSec , int fairShare )
+{
+    orderRate  = ordersPerSec ;
+    orderBurst = ordersPerSec > 1.0 ? ordersPerSec : 1.0 ;
+    partRate   = partsPerSec ;
+    partBurst  = partsPerSec ;
+    maxActive  = fairShare ;
+    rlOn       = 1 ;
+}
+
+/*--------------------------------------------------------------------
+   Make room for newcomers, an eighth of the table at a time. Forgetting
+   a client whose buckets are full and who has nothing in progress
+   changes nothing: it would come back with full buckets. If that is not
+   enough, the idle clients seen longest ago go too. Clients with orders
+   in progress are held by pointer and stay. Caller holds lock
+----------------------------------------------------------------------*/
+static int byLastMs( const void *a , const void *b )
+{
+    double x = ( *(rlClient * const *) a )->lastMs ,
+           y = ( *(rlClient * const *) b )->lastMs ;
+    return ( x > y ) - ( x < y ) ;
+}
+
+static void reclaim( void )
+{
+    static rlClient *idle[ RL_CLIENTS ] ;
+    int nIdle = 0 , freed = 0 ;
+
+    for ( int i = 0 ; i < RL_CLIENTS ; i++ )
+    {
+        rlClient *c = &clients[ i ] ;
+        if ( c->ip == 0 || c->ip == RL_FREED || c->active > 0 )
+            continue ;
+
+        refill( c ) ;
+        if ( c->orderTokens >= orderBurst && c->partTokens >= partBurst )
+        {
+            c->ip = RL_FREED ;
+            freed++ ;
+        }
+        else
+            idle[ nIdle++ ] = c ;
+    }
+
+    if ( freed < RL_CLIENTS / 8 && nIdle > 0 )
+    {
+        qsort( idle , nIdle , sizeof( idle[ 0 ] ) , byLastMs ) ;
+        for ( int k = 0 ; k < nIdle && freed < RL_CLIENTS / 8 ; k++ )
+        {
+            idle[ k ]->ip = RL_FREED ;
+            freed++ ;
+        }
+    }
+    used -= freed ;
+
+    // A freed slot just before a never-used one ends no probe early:
+    // make it never-used too, so probes for new clients stay short
+    for ( int pass = 0 ; pass < 2 ; pass++ )
+        for ( int i = RL_CLIENTS - 1 ; i >= 0 ; i-- )
+            if ( clients[ i ].ip == RL_FREED && clients[ ( i + 1 ) & SLOT_MASK ].ip == 0 )
+                clients[ i ].ip = 0 ;
+}
+
+/*--------------------------------------------------------------------
+   The entry for a client address; new clients start with full buckets.
+   Only main calls it, so an entry it returns stays put until main's
+   next call or, once admitted, until the order is done
+----------------------------------------------------------------------*/
+rlClient *rlClientOf( uint32_t ip )
+{
+    rlClient *c = NULL , *freed = NULL ;
+    unsigned  start = ( ip * 2654435761u ) & SLOT_MASK , i = start ;
+
+    pthread_mutex_lock( &lock ) ;
+    for ( int probes = 0 ; probes < RL_CLIENTS ; probes++ , i = ( i + 1 ) & SLOT_MASK )
+    {
+        if ( clients[ i ].ip == ip )
+        {
+            c = &clients[ i ] ;
+            break ;
+        }
+        if ( clients[ i ].ip == RL_FREED && freed == NULL )
+            freed = &clients[ i ] ;
+        if ( clients[ i ].ip == 0 )
+            break ;
+    }
+
+    if ( c == NULL )
+    {
+        // The probe stopped at a never-used slot; a reclaimed one on the
+        // way is as good. Keep the table at most half full so probes
+        // stay short
+        if ( used >= RL_CLIENTS / 2 )
+        {
+            reclaim() ;
+            for ( i = start ; clients[ i ].ip != 0 && clients[ i ].ip != RL_FREED ; )
+                i = ( i + 1 ) & SLOT_MASK ;
+            freed = &clients[ i ] ;
+        }
+
+        c = freed != NULL ? freed : &clients[ i ] ;
+        memset( c , 0 , sizeof( *c ) ) ;
+        c->ip          = ip ;
+        c->orderTokens = orderBurst ;
+        c->partTokens  = partBurst ;
+        c->lastMs      = monoMs() ;
+        used++ ;
+    }
+    pthread_mutex_unlock( &lock ) ;
+
+    return c ;
+}
+
+/*--------------------------------------------------------------------
+   May this client start another order? If not, '*retryMs' is how long
+   it should wait before asking again
+----------------------------------------------------------------------*/
+int rlAdmit( rlClient *c , unsigned *retryMs )
+{
+    int verdict = RL_ADMIT ;
+
+    pthread_mutex_lock( &lock ) ;
+    refill( c ) ;
+
+    if ( maxActive > 0 && c->active >= maxActive )
+    {
+        verdict  = RL_DEFER ;
+        *retryMs = RL_BUSYRETRY ;
+    }
+    else if ( orderRate > 0 && c->orderTokens < 1.0 )
+    {
+        double wait = ( 1.0 - c->orderTokens ) / orderRate * 1000.0 ;
+
+        verdict  = wait <= RL_MAXDEFER ? RL_DEFER : RL_REJECT ;
+        *retryMs = (unsigned) wait + 1 ;
+    }
+
+    switch ( verdict )
+    {
+        case RL_ADMIT :
+            if ( orderRate > 0 )
+                c->orderTokens -= 1.0 ;
+            c->active++ ;
+            c->admitted++ ;
+            break ;
+
+        case RL_DEFER :
+            c->deferred++ ;
+            break ;
+
+        default :
+            c->rejected++ ;
+            break ;
+    }
+    pthread_mutex_unlock( &lock ) ;
+
+    return verdict ;
+}
+
+/*--------------------------------------------------------------------
+   One of the client's orders is done. '*usage' (if not NULL) gets a
+   copy of its entry first: once idle, the entry may be reclaimed
+----------------------------------------------------------------------*/
+void rlOrderDone( rlClient *c , rlClient *usage )
+{
+    pthread_mutex_lock( &lock ) ;
+    if ( usage != NULL )
+        *usage = *c ;
+    c->active-- ;
+    pthread_mutex_unlock( &lock ) ;
+}
+
+/*--------------------------------------------------------------------
+   Charge 'parts' to the client. The bucket may go into debt; the
+   caller waits the returned msec before making them, so a client's
+   parts come out no faster than its rate
+----------------------------------------------------------------------*/
+double rlTakeParts( rlClient *c , uint64_t parts )
+{
+    double wait = 0 ;
+
+    pthread_mutex_lock( &lock ) ;
+    c->parts += parts ;
+    if ( partRate > 0 )
+    {
+        refill( c ) ;
+        c->partTokens -= (double) parts ;
+        if ( c->partTokens < 0 )
+            wait = -c->partTokens / partRate * 1000.0 ;
+    }
+    pthread_mutex_unlock( &lock ) ;
+
+    return wait ;
+}
+
+//------------------
+
+void rlThrottled( rlClient *c , double ms )
+{
+    pthread_mutex_lock( &lock ) ;
+    c->throttledMs += ms ;
+    pthread_mutex_unlock( &lock ) ;
+}
+
@@ -0,0 +1,48 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : ratelimit.h
+//---------------------------------------------------------------------
+
+#ifndef  RATELIMIT_H
+#define  RATELIMIT_H
+
+#include <stdint.h>
+
+#define RL_CLIENTS      4096    /* client addresses tracked: power of 2     */
+#define RL_MAXDEFER     2000    /* defer up to this many msec, else reject  */
+#define RL_BUSYRETRY    250     /* retry hint when over the fair share      */
+#define RL_FREED        0xffffffffu   /* 255.255.255.255 is never a source  */
+
+typedef enum
+{
+    RL_ADMIT = 1 , RL_DEFER , RL_REJECT
+} rlVerdict_t ;
+
+/* ---------- One client address: its token buckets and its usage -------- */
+typedef struct {
+    uint32_t       ip ;             /* network order; 0 = never used,
+                                       RL_FREED = reclaimed                 */
+    double         orderTokens ,
+                   partTokens ,     /* may go negative: parts owed          */
+                   lastMs ;         /* when the buckets were last refilled  */
+    int            active ;         /* orders in progress                   */
+
+    unsigned long  admitted ,
+                   deferred ,
+                   rejected ;
+    uint64_t       parts ;
+    double         throttledMs ;    /* sub-factories held back for parts    */
+} rlClient ;
+
+extern int rlOn ;
+
+void       rlInit( double ordersPerSec , double partsPerSec , int fairShare ) ;
+rlClient  *rlClientOf( uint32_t ip ) ;
+int        rlAdmit( rlClient *c , unsigned *retryMs ) ;   /* rlVerdict_t */
+void       rlOrderDone( rlClient *c , rlClient *usage ) ;  /* usage: or NULL */
+double     rlTakeParts( rlClient *c , uint64_t parts ) ;  /* msec to wait */
+void       rlThrottled( rlClient *c , double ms ) ;
+
+#endif
@@ -0,0 +1,259 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : session.c
+//
+// Session table: open addressing (linear probing) over slab indices.
+// It doubles as the factory's bounded dedup cache: a finished session is
+// kept so a retransmitted request for it is recognised. Finished sessions
+// sit on an LRU idle list and are evicted once they have been idle for
+// SESSION_IDLE seconds, or earlier if the slab runs out. So do sessions
+// waiting for an order context, which their client's retries keep at
+// the young end: one whose client gave up is evicted the same way. Not
+// thread safe: callers hold the factory mutex.
+//---------------------------------------------------------------------
+
+#include "wrappers.h"
+#include "slab.h"
+#include "session.h"
+
+#define SLOT_MASK   ( SESSION_SLOTS - 1 )
+#define EMPTY       ( -1 )
+
+static slab  pool ;                     /* MAXSESSIONS session objects      */
+static int   slots[ SESSION_SLOTS ] ;   /* slab index, or EMPTY             */
+static int   idleHead = EMPTY ,         /* least recently finished          */
+             idleTail = EMPTY ;
+
+static unsigned hashKey( uint32_t ip , uint16_t port , unsigned orderID )
+{
+    uint64_t k = ( (uint64_t) ip << 16 ) ^ port ^ ( (uint64_t) orderID << 40 ) ;
+
+    // splitmix64 finalizer
+    k ^= k >> 30 ;  k *= 0xbf58476d1ce4e5b9ULL ;
+    k ^= k >> 27 ;  k *= 0x94d049bb133111ebULL ;
+    k ^= k >> 31 ;
+
+    return (unsigned) k & SLOT_MASK ;
+}
+
+//------------------
+
+static unsigned homeSlot( session *s )
+{
+    return hashKey( s->ip , s->port , s->orderID ) ;
+}
+
+//------------------
+
+void sessionInit( void )
+{
+    slabInit( &pool , MAXSESSIONS , sizeof( session ) ) ;
+
+    for ( int i = 0 ; i < SESSION_SLOTS ; i++ )
+        slots[ i ] = EMPTY ;
+}
+
+/*--------------------------------------------------------------------
+   Idle list helpers
+----------------------------------------------------------------------*/
+static void idleUnlink( session *s )
+{
+    if ( s->idlePrev != EMPTY )
+        ( (session *) slabAt( &pool , s->idlePrev ) )->idleNext = s->idleNext ;
+    else
+        idleHead = s->idleNext ;
+
+    if ( s->idleNext != EMPTY )
+        ( (session *) slabAt( &pool , s->idleNext ) )->idlePrev = s->idlePrev ;
+    else
+        idleTail = s->idlePrev ;
+
+    s->idlePrev = s->idleNext = EMPTY ;
+}
+
+//------------------
+
+static int idleLinked( session *s )
+{
+    return s->idlePrev != EMPTY || idleHead == slabIndex( &pool , s ) ;
+}
+
+//------------------
+
+static void idleAppend( session *s )
+{
+    int idx = slabIndex( &pool , s ) ;
+
+    s->idlePrev = idleTail ;
+    s->idleNext = EMPTY ;
+    if ( idleTail != EMPTY )
+        ( (session *) slabAt( &pool , idleTail ) )->idleNext = idx ;
+    else
+        idleHead = idx ;
+    idleTail = idx ;
+}
+
+/*--------------------------------------------------------------------
+   Remove a finished session, closing the gap it leaves in its probe
+   run by shifting later entries back (no tombstones)
+----------------------------------------------------------------------*/
+static void sessionRemove( session *s )
+{
+    int      idx = slabIndex( &pool , s ) ;
+    unsigned i   = homeSlot( s ) ;
+
+    while ( slots[ i ] != idx )
+        i = ( i + 1 ) & SLOT_MASK ;
+
+    slots[ i ] = EMPTY ;
+    for ( unsigned j = ( i + 1 ) & SLOT_MASK ; slots[ j ] != EMPTY ; j = ( j + 1 ) & SLOT_MASK )
+    {
+        unsigned k = homeSlot( (session *) slabAt( &pool , slots[ j ] ) ) ;
+
+        // Move slots[j] back to i unless its home lies cyclically in (i, j]
+        int stays = ( i <= j ) ? ( i < k && k <= j ) : ( i < k || k <= j ) ;
+        if ( !stays )
+        {
+            slots[ i ] = slots[ j ] ;
+            slots[ j ] = EMPTY ;
+            i = j ;
+        }
+    }
+
+    idleUnlink( s ) ;
+    slabFree( &pool , s ) ;
+}
+
+/*--------------------------------------------------------------------
+   Look up a client's order. NULL if unknown
+----------------------------------------------------------------------*/
+session *sessionFind( struct sockaddr_in *clnt , unsigned orderID )
+{
+    uint32_t ip   = clnt->sin_addr.s_addr ;
+    uint16_t port = clnt->sin_port ;
+
+    for ( unsigned i = hashKey( ip , port , orderID ) ; slots[ i ] != EMPTY ; i = ( i + 1 ) & SLOT_MASK )
+    {
+        session *s = slabAt( &pool , slots[ i ] ) ;
+        if ( s->ip == ip && s->port == port && s->orderID == orderID )
+            return s ;
+    }
+
+    return NULL ;
+}
+
+/*--------------------------------------------------------------------
+   Add a new ACTIVE session. If the slab is full the least recently
+   finished session is evicted early. NULL if every session is active
+----------------------------------------------------------------------*/
+session *sessionInsert( struct sockaddr_in *clnt , unsigned orderID , time_t now )
+{
+    if ( slabInUse( &pool ) == MAXSESSIONS && idleHead != EMPTY )
+        sessionRemove( slabAt( &pool , idleHead ) ) ;
+
+    session *s = slabAlloc( &pool ) ;
+    if ( s == NULL )
+        return NULL ;
+
+    s->ip         = clnt->sin_addr.s_addr ;
+    s->port       = clnt->sin_port ;
+    s->orderID    = orderID ;
+    s->state      = SESS_ACTIVE ;
+    s->lastActive = now ;
+    s->idlePrev   = s->idleNext = EMPTY ;
+
+    unsigned i = homeSlot( s ) ;
+    while ( slots[ i ] != EMPTY )
+        i = ( i + 1 ) & SLOT_MASK ;
+    slots[ i ] = slabIndex( &pool , s ) ;
+
+    return s ;
+}
+
+/*--------------------------------------------------------------------
+   The session's order is finished; it becomes an eviction candidate
+----------------------------------------------------------------------*/
+void sessionIdle( session *s , time_t now )
+{
+    s->state      = SESS_DONE ;
+    s->lastActive = now ;
+    s->order      = NULL ;
+    idleAppend( s ) ;
+}
+
+/*--------------------------------------------------------------------
+   The session's order waits for an order context; its client was told
+   to retry. Until it does, the session ages like a finished one
+----------------------------------------------------------------------*/
+void sessionWait( session *s , time_t now )
+{
+    if ( idleLinked( s ) )
+        idleUnlink( s ) ;
+
+    s->state      = SESS_WAITING ;
+    s->lastActive = now ;
+    s->order      = NULL ;
+    idleAppend( s ) ;
+}
+
+/*--------------------------------------------------------------------
+   The session's order got its context: ACTIVE, and no longer evictable
+----------------------------------------------------------------------*/
+void sessionStart( session *s , time_t now )
+{
+    if ( idleLinked( s ) )
+        idleUnlink( s ) ;
+
+    s->state      = SESS_ACTIVE ;
+    s->lastActive = now ;
+}
+
+/*--------------------------------------------------------------------
+   Drop sessions idle for SESSION_IDLE seconds. Returns how many
+----------------------------------------------------------------------*/
+int sessionEvict( time_t now )
+{
+    int n = 0 ;
+
+    while ( idleHead != EMPTY )
+    {
+        session *s = slabAt( &pool , idleHead ) ;
+        if ( now - s->lastActive < SESSION_IDLE )
+            break ;
+
+        sessionRemove( s ) ;
+        n++ ;
+    }
+
+    return n ;
+}
+
+/*--------------------------------------------------------------------
+   Collect up to 'max' ACTIVE sessions into 'out'. Returns how many.
+   Walks the whole table: only for a hand-off
+----------------------------------------------------------------------*/
+int sessionActive( session **out , int max )
+{
+    int n = 0 ;
+
+    for ( int i = 0 ; i < SESSION_SLOTS && n < max ; i++ )
+    {
+        if ( slots[ i ] == EMPTY )
+            continue ;
+
+        session *s = slabAt( &pool , slots[ i ] ) ;
+        if ( s->state == SESS_ACTIVE )
+            out[ n++ ] = s ;
+    }
+
+    return n ;
+}
+
+//------------------
+
+int sessionCount( void )
+{
+    return slabInUse( &pool ) ;
+}
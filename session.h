@@ -0,0 +1,53 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : session.h
+//---------------------------------------------------------------------
+
+#ifndef  SESSION_H
+#define  SESSION_H
+
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#define MAXSESSIONS     131072      /* live sessions the table can hold      */
+#define SESSION_SLOTS   262144      /* hash slots: power of 2, load <= 1/2   */
+#define SESSION_IDLE    60          /* seconds a done order is remembered    */
+
+typedef enum
+{
+    SESS_ACTIVE = 1 , SESS_DONE ,
+    SESS_WAITING               /* no order context free yet; client retries */
+} sessState_t ;
+
+/* ----------- One client order: (IP, port, orderID) -> its state -------- */
+typedef struct {
+    uint32_t  ip ;             /* client address, network order          */
+    uint16_t  port ;
+    unsigned  orderID ;        /* client-chosen tag from the REQUEST_MSG  */
+
+    int       state ;          /* sessState_t                            */
+    time_t    lastActive ;     /* monotonic seconds                      */
+    uint64_t  orderSize ,
+              partsMade ,
+              fromStock ;      /* parts served from stock, not made       */
+    int       numFac ;
+    void     *order ;          /* the factory's order context while active */
+
+    int       idlePrev ,       /* links in the idle (LRU) list            */
+              idleNext ;
+} session ;
+
+void      sessionInit( void ) ;
+session  *sessionFind( struct sockaddr_in *clnt , unsigned orderID ) ;
+session  *sessionInsert( struct sockaddr_in *clnt , unsigned orderID , time_t now ) ;
+void      sessionIdle( session *s , time_t now ) ;
+void      sessionWait( session *s , time_t now ) ;
+void      sessionStart( session *s , time_t now ) ;
+int       sessionEvict( time_t now ) ;
+int       sessionActive( session **out , int max ) ;
+int       sessionCount( void ) ;
+
+#endif
@@ -0,0 +1,74 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : slab.c
+//
+// Objects are handed out from one preallocated block, so the hot path
+// never calls malloc() and memory use is fixed at startup.
+// Not thread safe: callers serialize access.
+//---------------------------------------------------------------------
+
+#include "wrappers.h"
+#include "slab.h"
+
+/*--------------------------------------------------------------------
+   Allocate and pre-fault room for 'count' objects
+----------------------------------------------------------------------*/
+void slabInit( slab *s , int count , size_t objSize )
+{
+    s->objSize   = objSize ;
+    s->count     = count ;
+    s->mem       = malloc( (size_t) count * objSize ) ;
+    s->freeStack = malloc( (size_t) count * sizeof( int ) ) ;
+    if ( s->mem == NULL || s->freeStack == NULL )
+        err_quit( "slabInit: out of memory\n" ) ;
+
+    // Touch every page now rather than on first use
+    memset( s->mem , 0 , (size_t) count * objSize ) ;
+
+    // Hand out low indices first
+    for ( int i = 0 ; i < count ; i++ )
+        s->freeStack[ i ] = count - 1 - i ;
+    s->freeTop = count ;
+}
+
+//------------------
+
+void *slabAlloc( slab *s )
+{
+    if ( s->freeTop == 0 )
+        return NULL ;
+
+    void *obj = slabAt( s , s->freeStack[ --s->freeTop ] ) ;
+    memset( obj , 0 , s->objSize ) ;
+    return obj ;
+}
+
+//------------------
+
+void slabFree( slab *s , void *obj )
+{
+    s->freeStack[ s->freeTop++ ] = slabIndex( s , obj ) ;
+}
+
+//------------------
+
+void *slabAt( slab *s , int idx )
+{
+    return s->mem + (size_t) idx * s->objSize ;
+}
+
+//------------------
+
+int slabIndex( slab *s , void *obj )
+{
+    return (int) ( ( (char *) obj - s->mem ) / s->objSize ) ;
+}
+
+//------------------
+
+int slabInUse( slab *s )
+{
+    return s->count - s->freeTop ;
+}
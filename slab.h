@@ -0,0 +1,29 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : slab.h
+//---------------------------------------------------------------------
+
+#ifndef  SLAB_H
+#define  SLAB_H
+
+#include <stddef.h>
+
+/* ------- Fixed-size object pool, allocated and touched once ------------ */
+typedef struct {
+    char   *mem ;          /* count objects of objSize bytes each  */
+    size_t  objSize ;
+    int     count ;
+    int    *freeStack ;    /* indices of free objects               */
+    int     freeTop ;      /* number of entries in freeStack        */
+} slab ;
+
+void   slabInit( slab *s , int count , size_t objSize ) ;
+void  *slabAlloc( slab *s ) ;           /* NULL when exhausted */
+void   slabFree( slab *s , void *obj ) ;
+void  *slabAt( slab *s , int idx ) ;
+int    slabIndex( slab *s , void *obj ) ;
+int    slabInUse( slab *s ) ;
+
+#endif
@@ -0,0 +1,176 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : stock.c
+//
+// Make-to-stock inventory. While no order is in progress, builder
+// threads with the same capacity/duration ranges as sub-factories make
+// parts into a shared stock, up to a high-water mark. New orders take
+// what they can from stock and manufacture only the rest.
+//---------------------------------------------------------------------
+
+#include <stdint.h>
+
+#include "wrappers.h"
+#include "trace.h"
+#include "stock.h"
+
+int stockOn = 0 ;
+
+static pthread_mutex_t  lock    = PTHREAD_MUTEX_INITIALIZER ;
+static pthread_cond_t   canWork = PTHREAD_COND_INITIALIZER ;
+static uint64_t  level ,            /* parts in stock                     */
+                 building ,         /* parts being made right now         */
+                 highWater ;
+static int       ordersRunning ,    /* builders only use idle capacity    */
+                 frozen ;           /* socket being handed off            */
+
+typedef struct {
+    int id , capacity , duration ;
+} builder ;
+
+static void *stockBuilder( void *arg ) ;
+
+/*--------------------------------------------------------------------
+   Start 'builders' builder threads. 'initial' parts are already in
+   stock (handed over by a previous factory)
+----------------------------------------------------------------------*/
+void stockStart( uint64_t mark , int builders , uint64_t initial )
+{
+    highWater = mark ;
+    level     = initial < mark ? initial : mark ;
+    stockOn   = 1 ;
+
+    for ( int i = 1 ; i <= builders ; i++ )
+    {
+        builder *b = malloc( sizeof( builder ) ) ;
+        if ( b == NULL )
+            err_quit( "Out of memory for stock builders\n" ) ;
+
+        b->id       = i ;
+        b->capacity = 10 + ( rand() % 41 ) ;     // [10,50]
+        b->duration = 500 + ( rand() % 701 ) ;   // [500,1200]
+
+        pthread_t tid ;
+        Pthread_create( &tid , NULL , stockBuilder , b ) ;
+        Pthread_detach( tid ) ;
+    }
+}
+
+/*--------------------------------------------------------------------
+   Serve up to 'want' parts from stock
+----------------------------------------------------------------------*/
+uint64_t stockTake( uint64_t want )
+{
+    pthread_mutex_lock( &lock ) ;
+    uint64_t n = want < level ? want : level ;
+    level -= n ;
+    pthread_mutex_unlock( &lock ) ;
+
+    return n ;
+}
+
+//------------------
+
+void stockOrderStart( void )
+{
+    pthread_mutex_lock( &lock ) ;
+    ordersRunning++ ;
+    pthread_mutex_unlock( &lock ) ;
+}
+
+//------------------
+
+void stockOrderDone( void )
+{
+    pthread_mutex_lock( &lock ) ;
+    if ( --ordersRunning == 0 )
+        pthread_cond_broadcast( &canWork ) ;
+    pthread_mutex_unlock( &lock ) ;
+}
+
+//------------------
+
+uint64_t stockLevel( void )
+{
+    pthread_mutex_lock( &lock ) ;
+    uint64_t n = level ;
+    pthread_mutex_unlock( &lock ) ;
+
+    return n ;
+}
+
+//------------------
+
+uint64_t stockHighWater( void )
+{
+    return highWater ;
+}
+
+/*--------------------------------------------------------------------
+   Stop building and selling. Batches in progress are dropped, so the
+   level returned is exactly what the next owner may sell
+----------------------------------------------------------------------*/
+uint64_t stockFreeze( void )
+{
+    pthread_mutex_lock( &lock ) ;
+    frozen = 1 ;
+    uint64_t n = level ;
+    level = 0 ;
+    pthread_cond_broadcast( &canWork ) ;
+    pthread_mutex_unlock( &lock ) ;
+
+    return n ;
+}
+
+/*--------------------------------------------------------------------
+   The replacement never took over: the stock is ours again
+----------------------------------------------------------------------*/
+void stockThaw( uint64_t n )
+{
+    pthread_mutex_lock( &lock ) ;
+    frozen = 0 ;
+    level  = n ;
+    pthread_cond_broadcast( &canWork ) ;
+    pthread_mutex_unlock( &lock ) ;
+}
+
+/*--------------------------------------------------------------------
+   Builder: make one batch at a time while the factory is idle and the
+   stock (counting batches in progress) is below the high-water mark
+----------------------------------------------------------------------*/
+static void *stockBuilder( void *arg )
+{
+    builder *b = (builder *) arg ;
+
+    traceThreadName( "stock builder %d" , b->id ) ;
+
+    while ( 1 )
+    {
+        pthread_mutex_lock( &lock ) ;
+        while ( frozen || ordersRunning > 0 || level + building >= highWater )
+        {
+            traceFlush() ;
+            pthread_cond_wait( &canWork , &lock ) ;
+        }
+
+        uint64_t n = highWater - level - building ;
+        if ( n > (uint64_t) b->capacity )
+            n = b->capacity ;
+        building += n ;
+        pthread_mutex_unlock( &lock ) ;
+
+        uint64_t tr = traceNow() ;
+        Usleep( (useconds_t) b->duration * 1000 ) ;
+        traceSpan( "build stock" , tr , 0 ) ;
+
+        pthread_mutex_lock( &lock ) ;
+        building -= n ;
+        if ( !frozen )
+            level += n ;
+        pthread_mutex_unlock( &lock ) ;
+    }
+
+    return NULL ;
+}
@@ -0,0 +1,24 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : stock.h
+//---------------------------------------------------------------------
+
+#ifndef  STOCK_H
+#define  STOCK_H
+
+#include <stdint.h>
+
+extern int stockOn ;
+
+void      stockStart( uint64_t highWater , int builders , uint64_t initial ) ;
+uint64_t  stockTake( uint64_t want ) ;     /* returns how many were taken */
+void      stockOrderStart( void ) ;        /* builders pause while orders run */
+void      stockOrderDone( void ) ;
+uint64_t  stockLevel( void ) ;
+uint64_t  stockHighWater( void ) ;
+uint64_t  stockFreeze( void ) ;            /* stop building; returns the level */
+void      stockThaw( uint64_t level ) ;    /* hand-off failed: carry on        */
+
+#endif
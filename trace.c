@@ -0,0 +1,305 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : trace.c
+//
+// Per-thread timeline tracing in Chrome/Perfetto trace-event format.
+// Each thread records spans into its own buffer without locking. When
+// the buffer fills up or the thread ends it is queued for a writer
+// thread, so traced threads never format or write anything. Buffers come
+// from a slab sized at startup, so tracing never calls malloc() once on.
+//---------------------------------------------------------------------
+
+#include <sys/syscall.h>
+#include <stdarg.h>
+
+#include "wrappers.h"
+#include "slab.h"
+#include "trace.h"
+
+typedef struct {
+    const char *name ;          /* string literal */
+    uint64_t    startNs ,
+                endNs ;
+    unsigned    orderID ;
+} traceEvent ;
+
+typedef struct traceBuf {
+    struct traceBuf *next ;     /* in the writer's queue */
+    int         tid ;
+    int         used ;          /* published with release: see traceClose() */
+    int         owned ;         /* a running thread still records into it  */
+    char        threadName[ 48 ] ;
+    traceEvent  ev[ TRACE_EVENTS ] ;
+} traceBuf ;
+
+int traceOn = 0 ;
+
+static FILE            *traceFile ;
+static pthread_mutex_t  traceLock = PTHREAD_MUTEX_INITIALIZER ;
+static slab             bufPool ;
+static traceBuf        *queueHead , *queueTail ;   /* waiting to be written */
+static sem_t            queued ;
+static int              closing ;
+static pthread_t        writerTid ;
+static int              pid ;
+static unsigned long    dropped ;       /* events lost: no buffer free */
+static int              firstEvent = 1 ;
+
+static __thread traceBuf *myBuf ;
+
+static void *traceWriter( void *arg ) ;
+
+//------------------
+
+uint64_t traceClock( void )
+{
+    struct timespec ts ;
+    clock_gettime( CLOCK_MONOTONIC , &ts ) ;
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec ;
+}
+
+/*--------------------------------------------------------------------
+   Start tracing into 'path'. 'maxThreads' bounds the number of threads
+   that can hold a buffer at the same time
+----------------------------------------------------------------------*/
+void traceOpen( const char *path , int maxThreads )
+{
+    traceFile = fopen( path , "w" ) ;
+    if ( traceFile == NULL )
+        err_sys( "Could not open trace file" ) ;
+
+    // Room for every thread's buffer plus as many again waiting to be written
+    slabInit( &bufPool , 2 * maxThreads , sizeof( traceBuf ) ) ;
+    Sem_init( &queued , 0 , 0 ) ;
+    pid = getpid() ;
+    fputs( "[\n" , traceFile ) ;
+
+    Pthread_create( &writerTid , NULL , traceWriter , NULL ) ;
+    traceOn = 1 ;
+}
+
+/*--------------------------------------------------------------------
+   Write one JSON object, with the separator the array needs
+----------------------------------------------------------------------*/
+static void emit( const char *fmt , ... )
+{
+    va_list ap ;
+
+    if ( !firstEvent )
+        fputs( ",\n" , traceFile ) ;
+    firstEvent = 0 ;
+
+    va_start( ap , fmt ) ;
+    vfprintf( traceFile , fmt , ap ) ;
+    va_end( ap ) ;
+}
+
+/*--------------------------------------------------------------------
+   Fresh buffer for the calling thread. NULL if the pool is exhausted
+----------------------------------------------------------------------*/
+static traceBuf *newBuf( const char *threadName , int tid )
+{
+    pthread_mutex_lock( &traceLock ) ;
+    traceBuf *b = slabAlloc( &bufPool ) ;
+    if ( b != NULL )
+        b->owned = 1 ;
+    pthread_mutex_unlock( &traceLock ) ;
+
+    if ( b != NULL )
+    {
+        b->tid = tid ;
+        strcpy( b->threadName , threadName ) ;
+    }
+    return b ;
+}
+
+//------------------
+
+static traceBuf *threadBuf( void )
+{
+    if ( myBuf == NULL )
+        myBuf = newBuf( "" , (int) syscall( SYS_gettid ) ) ;
+    return myBuf ;
+}
+
+/*--------------------------------------------------------------------
+   Hand a buffer to the writer thread; the caller never formats or
+   writes anything itself
+----------------------------------------------------------------------*/
+static void queueBuf( traceBuf *b )
+{
+    b->next = NULL ;
+
+    pthread_mutex_lock( &traceLock ) ;
+    b->owned = 0 ;
+    if ( queueTail != NULL )
+        queueTail->next = b ;
+    else
+        queueHead = b ;
+    queueTail = b ;
+    pthread_mutex_unlock( &traceLock ) ;
+
+    Sem_post( &queued ) ;
+}
+
+/*--------------------------------------------------------------------
+   Swap in an empty buffer and let the writer have the current one
+----------------------------------------------------------------------*/
+static traceBuf *swapBuf( void )
+{
+    traceBuf *b = myBuf ;
+
+    myBuf = newBuf( b->threadName , b->tid ) ;
+    queueBuf( b ) ;
+    return myBuf ;
+}
+
+/*--------------------------------------------------------------------
+   Record a span from 'startNs' (from traceNow()) until now
+----------------------------------------------------------------------*/
+void traceRecord( const char *name , uint64_t startNs , unsigned orderID )
+{
+    uint64_t  endNs = traceClock() ;
+    traceBuf *b     = threadBuf() ;
+
+    if ( b != NULL && b->used == TRACE_EVENTS )
+        b = swapBuf() ;
+
+    if ( b == NULL )
+    {
+        __atomic_add_fetch( &dropped , 1 , __ATOMIC_RELAXED ) ;
+        return ;
+    }
+
+    traceEvent *e = &b->ev[ b->used ] ;
+    e->name    = name ;
+    e->startNs = startNs ;
+    e->endNs   = endNs ;
+    e->orderID = orderID ;
+    __atomic_store_n( &b->used , b->used + 1 , __ATOMIC_RELEASE ) ;
+}
+
+/*--------------------------------------------------------------------
+   Label the calling thread's track in the trace viewer
+----------------------------------------------------------------------*/
+void traceThreadName( const char *fmt , ... )
+{
+    va_list  ap ;
+
+    if ( !traceOn || threadBuf() == NULL )
+        return ;
+
+    va_start( ap , fmt ) ;
+    vsnprintf( myBuf->threadName , sizeof( myBuf->threadName ) , fmt , ap ) ;
+    va_end( ap ) ;
+}
+
+/*--------------------------------------------------------------------
+   Write out what a long-lived thread has recorded so far; call it
+   when the thread is about to go idle
+----------------------------------------------------------------------*/
+void traceFlush( void )
+{
+    if ( traceOn && myBuf != NULL && myBuf->used > 0 )
+        swapBuf() ;
+}
+
+/*--------------------------------------------------------------------
+   The calling thread is about to exit: pass its buffer to the writer
+----------------------------------------------------------------------*/
+void traceThreadEnd( void )
+{
+    if ( !traceOn || myBuf == NULL )
+        return ;
+
+    queueBuf( myBuf ) ;
+    myBuf = NULL ;
+}
+
+/*--------------------------------------------------------------------
+   Format the first 'used' events of a buffer
+----------------------------------------------------------------------*/
+static void writeBuf( traceBuf *b , int used )
+{
+    if ( b->threadName[ 0 ] != '\0' )
+        emit( "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+              "\"args\":{\"name\":\"%s\"}}" , pid , b->tid , b->threadName ) ;
+
+    for ( int i = 0 ; i < used ; i++ )
+    {
+        traceEvent *e = &b->ev[ i ] ;
+        emit( "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+              "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"order\":%u}}" ,
+              e->name , pid , b->tid , e->startNs / 1000.0 ,
+              ( e->endNs - e->startNs ) / 1000.0 , e->orderID ) ;
+    }
+}
+
+/*--------------------------------------------------------------------
+   Writer thread: format queued buffers and return them to the pool
+----------------------------------------------------------------------*/
+static void *traceWriter( void *arg )
+{
+    while ( 1 )
+    {
+        Sem_wait( &queued ) ;
+
+        pthread_mutex_lock( &traceLock ) ;
+        traceBuf *b = queueHead ;
+        if ( b == NULL )                // woken by traceClose()
+        {
+            pthread_mutex_unlock( &traceLock ) ;
+            if ( closing )
+                break ;
+            continue ;
+        }
+        queueHead = b->next ;
+        if ( queueHead == NULL )
+            queueTail = NULL ;
+        pthread_mutex_unlock( &traceLock ) ;
+
+        writeBuf( b , b->used ) ;
+
+        pthread_mutex_lock( &traceLock ) ;
+        slabFree( &bufPool , b ) ;
+        pthread_mutex_unlock( &traceLock ) ;
+    }
+
+    return NULL ;
+}
+
+/*--------------------------------------------------------------------
+   Write out everything queued, then what threads still running have
+   recorded so far, and finish the file. Call it from a normal thread,
+   never from a signal handler
+----------------------------------------------------------------------*/
+void traceClose( void )
+{
+    if ( !traceOn )
+        return ;
+
+    traceThreadEnd() ;
+    traceOn = 0 ;
+
+    closing = 1 ;
+    Sem_post( &queued ) ;
+    Pthread_join( writerTid , NULL ) ;
+
+    // Events are complete up to the 'used' their owner last published
+    pthread_mutex_lock( &traceLock ) ;
+    for ( int i = 0 ; i < bufPool.count ; i++ )
+    {
+        traceBuf *b = slabAt( &bufPool , i ) ;
+        if ( b->owned )
+            writeBuf( b , __atomic_load_n( &b->used , __ATOMIC_ACQUIRE ) ) ;
+    }
+    pthread_mutex_unlock( &traceLock ) ;
+
+    fputs( "\n]\n" , traceFile ) ;
+    fclose( traceFile ) ;
+
+    if ( dropped > 0 )
+        fprintf( stderr , "trace: %lu events dropped (no free buffer)\n" , dropped ) ;
+}
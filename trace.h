@@ -0,0 +1,37 @@
+//---------------------------------------------------------------------
+// Assignment : PA-04 Multi-Threaded UDP Server
+// Date       : 12/01/25
+// Author     : Braden Drake, Aiden Smith
+// File Name  : trace.h
+//---------------------------------------------------------------------
+
+#ifndef  TRACE_H
+#define  TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_EVENTS    256     /* events buffered per thread before a flush */
+
+extern int traceOn ;
+
+void      traceOpen( const char *path , int maxThreads ) ;
+void      traceClose( void ) ;
+void      traceThreadName( const char *fmt , ... ) ;
+void      traceFlush( void ) ;
+void      traceThreadEnd( void ) ;
+uint64_t  traceClock( void ) ;
+void      traceRecord( const char *name , uint64_t startNs , unsigned orderID ) ;
+
+/* -------- Cheap when tracing is off: one well-predicted branch ---------- */
+static inline uint64_t traceNow( void )
+{
+    return traceOn ? traceClock() : 0 ;
+}
+
+static inline void traceSpan( const char *name , uint64_t startNs , unsigned orderID )
+{
+    if ( traceOn )
+        traceRecord( name , startNs , orderID ) ;
+}
+
+#endif
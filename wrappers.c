@@ -70,6 +70,33 @@ int Usleep( useconds_t usec )
 	}
 }
 
+/************************************************
+ * Sleep for 'msec' milliSeconds, however many: 
+   usleep() need not take a second or more
+  ************************************************/
+
+void Msleep( uint64_t msec )
+{
+    while ( msec > 1000 )
+    {
+        Usleep( 1000 * 1000 ) ;
+        msec -= 1000 ;
+    }
+    Usleep( (useconds_t) msec * 1000 ) ;
+}
+
+/************************************************
+ * Monotonic clock in milliSeconds, for deadlines,
+   durations and timeouts
+  ************************************************/
+
+double monoMs( void )
+{
+    struct timespec ts ;
+    clock_gettime( CLOCK_MONOTONIC , &ts ) ;
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6 ;
+}
+
 /************************************************
  * Wrapper for sigaction() 
   ***********************************************/
@@ -7,6 +7,8 @@
 #include <pthread.h>
 
 #include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
@@ -30,6 +32,8 @@ void    posix_error( int code, char *msg) ;
 
 pid_t   Fork(void);
 int     Usleep( useconds_t usec );
+void    Msleep( uint64_t msec );
+double  monoMs( void );
 
 typedef void Sigfunc( int ) ;
 Sigfunc * sigactionWrapper( int signo, Sigfunc *func ) ;